@@ -0,0 +1,93 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: arena.h
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 23:59:52
+ *  Description: Objects of any type allocated one after another in large
+ *               blocks, in order of creation, and all freed at once.
+ *****************************************************************************/
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+class Arena {
+    // blocks are this large, unless an object is larger
+    constexpr static size_t BLOCKSIZE = 1 << 16;
+
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    // bytes taken in the last block
+    size_t used;
+    size_t _bytes;
+    // objects to be destroyed, those trivially destructible aren't kept
+    std::vector< std::pair<void*, void (*)(void*)> > destructors;
+
+    template < class T >
+    static void destroy(void* p) { static_cast<T*>(p) -> ~T(); }
+
+    void* allocate(const size_t size, const size_t alignment) {
+        if (blocks.size()) {
+            uintptr_t begin = reinterpret_cast<uintptr_t>(blocks.back().data.get());
+            size_t offset = ((begin + used + alignment - 1) & ~uintptr_t(alignment - 1)) - begin;
+            if (offset + size <= blocks.back().size) {
+                used = offset + size;
+                _bytes += size;
+                return blocks.back().data.get() + offset;
+            }
+        }
+        // memory of new[] is aligned for any type
+        Block block;
+        block.size = std::max(size_t(BLOCKSIZE), size);
+        block.data.reset(new char[block.size]);
+        blocks.push_back(std::move(block));
+        used = size;
+        _bytes += size;
+        return blocks.back().data.get();
+    }
+
+public:
+    Arena(): used(0), _bytes(0) { }
+    ~Arena() { clear(); }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    template < class T, class... ARGS >
+    // a new T made of args, it lives until clear()
+    T* create(ARGS&&... args) {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned type");
+        T* p = new (allocate(sizeof(T), alignof(T))) T(std::forward<ARGS>(args)...);
+        if (!std::is_trivially_destructible<T>::value) destructors.push_back(std::make_pair(p, &destroy<T>));
+        return p;
+    }
+
+    // destroys all objects, last created first, and frees all blocks
+    void clear() {
+        for (auto ite = destructors.rbegin(); ite != destructors.rend(); ++ite) ite -> second(ite -> first);
+        destructors.clear();
+        blocks.clear();
+        used = _bytes = 0;
+    }
+
+    // bytes taken by objects
+    size_t bytes() const { return _bytes; }
+};
+
+#endif /* ARENA_H */
@@ -0,0 +1,440 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: bvh.h
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 10:12:40
+ *  Description: A bounding volume hierarchy built with surface area heuristic,
+ *               used to accelerate intersection.
+ *****************************************************************************/
+#ifndef BVH_H
+#define BVH_H
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <assert.h>
+#include <cmath>
+
+
+// DATATYPE: referenced data
+// ELEMTYPE: type of coordinate, such as int, float, double...
+// INTTYPE: integer type, such as int, long ...
+// REALTYPE: type fof coordinate for use of calculation, such as float, double...
+// MAXOBJCOUNT: max number of objects in a leaf node
+
+template < class DATATYPE, class ELEMTYPE, class INTTYPE, class REALTYPE, INTTYPE MAXOBJCOUNT >
+class BVH {
+    struct BoundingBox {
+        ELEMTYPE minBound[3];
+        ELEMTYPE maxBound[3];
+
+        BoundingBox() {
+            for (INTTYPE i = 0; i < 3; ++i) {
+                minBound[i] = std::numeric_limits<ELEMTYPE>::max();
+                maxBound[i] = -std::numeric_limits<ELEMTYPE>::max();
+            }
+        }
+
+        void expand(const BoundingBox& box) {
+            for (INTTYPE i = 0; i < 3; ++i) {
+                minBound[i] = std::min(minBound[i], box.minBound[i]);
+                maxBound[i] = std::max(maxBound[i], box.maxBound[i]);
+            }
+        }
+
+        void expand(const REALTYPE p[3]) {
+            for (INTTYPE i = 0; i < 3; ++i) {
+                minBound[i] = std::min(minBound[i], ELEMTYPE(p[i]));
+                maxBound[i] = std::max(maxBound[i], ELEMTYPE(p[i]));
+            }
+        }
+
+        REALTYPE surfaceArea() const {
+            if (minBound[0] > maxBound[0]) return 0;
+            REALTYPE dx = maxBound[0] - minBound[0];
+            REALTYPE dy = maxBound[1] - minBound[1];
+            REALTYPE dz = maxBound[2] - minBound[2];
+            return 2 * (dx * dy + dy * dz + dz * dx);
+        }
+
+        // slab test, returns false if the ray misses the box in [0, tMax]
+        bool intersect(const REALTYPE origin[3], const REALTYPE invDirection[3],
+                       const REALTYPE tMax, REALTYPE& tEntry) const {
+            REALTYPE tNear = 0, tFar = tMax;
+            for (INTTYPE i = 0; i < 3; ++i) {
+                REALTYPE t0 = (minBound[i] - origin[i]) * invDirection[i];
+                REALTYPE t1 = (maxBound[i] - origin[i]) * invDirection[i];
+                if (t0 > t1) std::swap(t0, t1);
+                // NaN (origin on the slab of a flat box) is dropped by max/min
+                tNear = std::max(tNear, t0);
+                tFar = std::min(tFar, t1);
+                if (tNear > tFar) return 0;
+            }
+            tEntry = tNear;
+            return 1;
+        }
+    };
+
+    struct Node {
+        BoundingBox box;
+        // leaf node: objects[offset, offset + count)
+        // internal node: left child is next to me, right child is nodes[offset]
+        INTTYPE offset;
+        INTTYPE count;
+        bool isLeafNode() const { return count > 0; }
+    };
+
+    // bins used to evaluate split candidates along one axis
+    constexpr static INTTYPE NUMBINS = 16;
+    // relative cost of traversing a node and intersecting an object
+    constexpr static REALTYPE TRAVERSALCOST = 1;
+    constexpr static REALTYPE INTERSECTIONCOST = 2;
+    // entries of traversal stacks. a node of depth d is popped with at most d
+    // entries left and pushes its two children, so nodes of MAXDEPTH are leaves
+    constexpr static INTTYPE STACKSIZE = 64;
+    constexpr static INTTYPE MAXDEPTH = STACKSIZE - 2;
+
+    std::vector< const DATATYPE* > objects;
+    std::vector< BoundingBox > objectBoxes;
+    std::vector< Node > nodes;
+    INTTYPE _depth;
+    bool built;
+
+    static BoundingBox boundingBox(const DATATYPE* obj) {
+        BoundingBox box;
+        box.minBound[0] = obj -> lowerBoundX();
+        box.minBound[1] = obj -> lowerBoundY();
+        box.minBound[2] = obj -> lowerBoundZ();
+        box.maxBound[0] = obj -> upperBoundX();
+        box.maxBound[1] = obj -> upperBoundY();
+        box.maxBound[2] = obj -> upperBoundZ();
+        return box;
+    }
+
+    static REALTYPE centroid(const BoundingBox& box, const INTTYPE axis) {
+        return (REALTYPE(box.minBound[axis]) + box.maxBound[axis]) / 2;
+    }
+
+    // builds subtree of objects[begin, end), returns index of the subtree root
+    INTTYPE buildRecursive(const INTTYPE begin, const INTTYPE end, const INTTYPE depth) {
+        _depth = std::max(_depth, depth);
+        INTTYPE nodeIndex = nodes.size();
+        nodes.push_back(Node());
+
+        BoundingBox box, centroidBox;
+        for (INTTYPE i = begin; i < end; ++i) {
+            box.expand(objectBoxes[i]);
+            REALTYPE c[3] = { centroid(objectBoxes[i], 0),
+                              centroid(objectBoxes[i], 1),
+                              centroid(objectBoxes[i], 2) };
+            centroidBox.expand(c);
+        }
+        nodes[nodeIndex].box = box;
+
+        INTTYPE count = end - begin;
+        REALTYPE leafCost = INTERSECTIONCOST * count;
+        REALTYPE bestCost = std::numeric_limits<REALTYPE>::max();
+        INTTYPE bestAxis = -1, bestBin = -1;
+
+        // evaluate binned SAH along all three axes
+        for (INTTYPE axis = 0; count > 1 && axis < 3; ++axis) {
+            REALTYPE lo = centroidBox.minBound[axis];
+            REALTYPE hi = centroidBox.maxBound[axis];
+            if (hi <= lo) continue;
+
+            BoundingBox binBoxes[NUMBINS];
+            INTTYPE binCounts[NUMBINS] = { 0 };
+            REALTYPE binScale = NUMBINS / (hi - lo);
+            for (INTTYPE i = begin; i < end; ++i) {
+                INTTYPE b = std::min(INTTYPE((centroid(objectBoxes[i], axis) - lo) * binScale),
+                                     NUMBINS - 1);
+                binBoxes[b].expand(objectBoxes[i]);
+                ++binCounts[b];
+            }
+
+            // sweep from right to left to get the cost of right parts
+            REALTYPE rightArea[NUMBINS];
+            INTTYPE rightCount[NUMBINS];
+            BoundingBox rightBox;
+            INTTYPE rightSum = 0;
+            for (INTTYPE b = NUMBINS - 1; b > 0; --b) {
+                rightBox.expand(binBoxes[b]);
+                rightSum += binCounts[b];
+                rightArea[b] = rightBox.surfaceArea();
+                rightCount[b] = rightSum;
+            }
+
+            BoundingBox leftBox;
+            INTTYPE leftSum = 0;
+            for (INTTYPE b = 0; b < NUMBINS - 1; ++b) {
+                leftBox.expand(binBoxes[b]);
+                leftSum += binCounts[b];
+                if (!leftSum || !rightCount[b + 1]) continue;
+                REALTYPE cost = leftBox.surfaceArea() * leftSum +
+                                rightArea[b + 1] * rightCount[b + 1];
+                if (cost < bestCost)
+                    bestCost = cost, bestAxis = axis, bestBin = b;
+            }
+        }
+
+        REALTYPE area = box.surfaceArea();
+        if (bestAxis >= 0 && area > 0)
+            bestCost = TRAVERSALCOST + INTERSECTIONCOST * bestCost / area;
+
+        // make a leaf if splitting doesn't pay off, or at max depth
+        if (bestAxis < 0 || (bestCost >= leafCost && count <= MAXOBJCOUNT) || depth >= MAXDEPTH) {
+            nodes[nodeIndex].offset = begin;
+            nodes[nodeIndex].count = count;
+            return nodeIndex;
+        }
+
+        REALTYPE lo = centroidBox.minBound[bestAxis];
+        REALTYPE binScale = NUMBINS / (centroidBox.maxBound[bestAxis] - lo);
+        INTTYPE mid = begin;
+        for (INTTYPE i = begin; i < end; ++i) {
+            INTTYPE b = std::min(INTTYPE((centroid(objectBoxes[i], bestAxis) - lo) * binScale),
+                                 NUMBINS - 1);
+            if (b <= bestBin) {
+                std::swap(objectBoxes[i], objectBoxes[mid]);
+                std::swap(objects[i], objects[mid]);
+                ++mid;
+            }
+        }
+        assert(mid > begin && mid < end);
+
+        buildRecursive(begin, mid, depth + 1);
+        INTTYPE rightChild = buildRecursive(mid, end, depth + 1);
+        nodes[nodeIndex].offset = rightChild;
+        nodes[nodeIndex].count = 0;
+        return nodeIndex;
+    }
+
+public:
+    BVH(): _depth(0), built(0) { }
+
+    INTTYPE size() const { return objects.size(); }
+    INTTYPE nodeCount() const { return nodes.size(); }
+    INTTYPE depth() const { return _depth; }
+
+    void clear() {
+        objects.clear();
+        objectBoxes.clear();
+        nodes.clear();
+        _depth = 0;
+        built = 0;
+    }
+
+    void insert(const DATATYPE* obj) {
+        objects.push_back(obj);
+        objectBoxes.push_back(boundingBox(obj));
+        built = 0;
+    }
+
+    // must be called after all objects are inserted and before searching
+    void build() {
+        nodes.clear();
+        _depth = 0;
+        if (objects.size()) {
+            nodes.reserve(2 * objects.size());
+            buildRecursive(0, objects.size(), 0);
+        }
+        built = 1;
+    }
+
+    template < class WRITER >
+    // writes the built tree, objects are written as numbers given by out
+    void save(WRITER& out) const {
+        assert(built);
+        out.write(_depth);
+        out.write(INTTYPE(objects.size()));
+        for (auto obj: objects) out.object(obj);
+        out.write(nodes);
+    }
+
+    template < class READER >
+    // reads a tree written by save, objects are taken from in by their numbers.
+    // nodes are checked with in.check(), so a corrupted tree is never traversed
+    // out of its arrays or deeper than its stacks
+    void load(READER& in) {
+        clear();
+        INTTYPE count, depth;
+        in.read(depth);
+        in.readCount(count);
+        for (INTTYPE i = 0; i < count && in.good(); ++i) {
+            const DATATYPE* obj;
+            in.object(obj);
+            insert(obj);
+        }
+        in.read(nodes);
+
+        // children come after their parents, so depths are known when they are reached
+        const INTTYPE n = nodes.size();
+        std::vector<INTTYPE> depths(n, 0);
+        for (INTTYPE i = 0; i < n && in.good(); ++i) {
+            const Node& node = nodes[i];
+            _depth = std::max(_depth, depths[i]);
+            if (node.isLeafNode()) {
+                in.check(node.offset >= 0 && node.count <= size() - node.offset);
+                continue;
+            }
+            if (!in.check(depths[i] < MAXDEPTH && node.offset > i + 1 && node.offset < n)) break;
+            depths[i + 1] = std::max(depths[i + 1], depths[i] + 1);
+            depths[node.offset] = std::max(depths[node.offset], depths[i] + 1);
+        }
+        in.check(depth == _depth);
+        built = in.good();
+    }
+
+    template < class LEAFFUNC >
+    // func(leaf, objects, count) for each leaf node, leaves are numbered
+    // the same as in searchLeaves and occludedLeaves
+    void forEachLeaf(LEAFFUNC func) const {
+        assert(built);
+        for (INTTYPE i = 0; i < INTTYPE(nodes.size()); ++i)
+            if (nodes[i].isLeafNode())
+                func(i, objects.data() + nodes[i].offset, nodes[i].count);
+    }
+
+    template < class LEAFFUNC >
+    // (ox, oy, oz) starting point coordinate
+    // (dx, dy, dz) direction
+    // all objects of a leaf are tested by one call func(leaf, closest),
+    // which lowers closest to the closest intersection in the leaf
+    // and returns true if there is any
+    bool searchLeaves(const ELEMTYPE ox, const ELEMTYPE oy, const ELEMTYPE oz,
+                      const ELEMTYPE dx, const ELEMTYPE dy, const ELEMTYPE dz,
+                      LEAFFUNC func) const {
+        assert(built);
+        if (nodes.empty()) return 0;
+
+        const REALTYPE origin[3] = { ox, oy, oz };
+        const REALTYPE invDirection[3] = { REALTYPE(1) / dx, REALTYPE(1) / dy, REALTYPE(1) / dz };
+        const bool dirNegative[3] = { dx < 0, dy < 0, dz < 0 };
+        // split axis is unknown, order children by the box min along the major direction
+        const INTTYPE axis = std::abs(dx) > std::abs(dy) ? (std::abs(dx) > std::abs(dz) ? 0 : 2):
+                                                           (std::abs(dy) > std::abs(dz) ? 1 : 2);
+
+        REALTYPE closest = std::numeric_limits<REALTYPE>::max();
+        REALTYPE tEntry;
+        bool found = 0;
+
+        INTTYPE stack[STACKSIZE];
+        INTTYPE stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize) {
+            const INTTYPE index = stack[--stackSize];
+            const Node& node = nodes[index];
+            if (!node.box.intersect(origin, invDirection, closest, tEntry)) continue;
+
+            if (node.isLeafNode()) {
+                if (func(index, closest)) found = 1;
+                continue;
+            }
+
+            // visit the nearer child first
+            INTTYPE leftChild = index + 1;
+            INTTYPE rightChild = node.offset;
+            assert(stackSize + 2 <= STACKSIZE);
+            bool leftFirst = nodes[leftChild].box.minBound[axis] <= nodes[rightChild].box.minBound[axis];
+            if (dirNegative[axis]) leftFirst = !leftFirst;
+            if (leftFirst) {
+                stack[stackSize++] = rightChild;
+                stack[stackSize++] = leftChild;
+            }
+            else {
+                stack[stackSize++] = leftChild;
+                stack[stackSize++] = rightChild;
+            }
+        }
+        return found;
+    }
+
+    template < class BOXFUNC, class LEAFFUNC >
+    // searchLeaves for rays (a bit mask) going about direction (dx, dy, dz),
+    // a node is visited once for all of them.
+    // hits(minBound, maxBound, rays) returns those of rays entering the box 
+    // before their closest intersection, func(leaf, rays) tests the leaf with them
+    void searchPacket(const ELEMTYPE dx, const ELEMTYPE dy, const ELEMTYPE dz, const unsigned rays,
+                      BOXFUNC hits, LEAFFUNC func) const {
+        assert(built);
+        if (nodes.empty()) return;
+
+        const bool dirNegative[3] = { dx < 0, dy < 0, dz < 0 };
+        const INTTYPE axis = std::abs(dx) > std::abs(dy) ? (std::abs(dx) > std::abs(dz) ? 0 : 2):
+                                                           (std::abs(dy) > std::abs(dz) ? 1 : 2);
+
+        // rays of a node are tested again when it's popped, 
+        // some may have found closer intersections meanwhile
+        struct Entry { INTTYPE index; unsigned rays; };
+        Entry stack[STACKSIZE];
+        INTTYPE stackSize = 0;
+        stack[stackSize++] = Entry{ 0, rays };
+        while (stackSize) {
+            const Entry entry = stack[--stackSize];
+            const Node& node = nodes[entry.index];
+            const unsigned active = hits(node.box.minBound, node.box.maxBound, entry.rays);
+            if (!active) continue;
+
+            if (node.isLeafNode()) {
+                func(entry.index, active);
+                continue;
+            }
+
+            INTTYPE leftChild = entry.index + 1;
+            INTTYPE rightChild = node.offset;
+            assert(stackSize + 2 <= STACKSIZE);
+            bool leftFirst = nodes[leftChild].box.minBound[axis] <= nodes[rightChild].box.minBound[axis];
+            if (dirNegative[axis]) leftFirst = !leftFirst;
+            if (leftFirst) {
+                stack[stackSize++] = Entry{ rightChild, active };
+                stack[stackSize++] = Entry{ leftChild, active };
+            }
+            else {
+                stack[stackSize++] = Entry{ leftChild, active };
+                stack[stackSize++] = Entry{ rightChild, active };
+            }
+        }
+    }
+
+    template < class LEAFFUNC >
+    // (ox, oy, oz) starting point coordinate
+    // (dx, dy, dz) direction
+    // returns true as soon as func(leaf) returns true for a leaf the ray 
+    // passes through within distance tMax
+    bool occludedLeaves(const ELEMTYPE ox, const ELEMTYPE oy, const ELEMTYPE oz,
+                        const ELEMTYPE dx, const ELEMTYPE dy, const ELEMTYPE dz,
+                        const ELEMTYPE tMax, LEAFFUNC func) const {
+        assert(built);
+        if (nodes.empty()) return 0;
+
+        const REALTYPE origin[3] = { ox, oy, oz };
+        const REALTYPE invDirection[3] = { REALTYPE(1) / dx, REALTYPE(1) / dy, REALTYPE(1) / dz };
+        REALTYPE tEntry;
+
+        INTTYPE stack[STACKSIZE];
+        INTTYPE stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize) {
+            const INTTYPE index = stack[--stackSize];
+            const Node& node = nodes[index];
+            if (!node.box.intersect(origin, invDirection, tMax, tEntry)) continue;
+
+            if (node.isLeafNode()) {
+                if (func(index)) return 1;
+                continue;
+            }
+
+            // any order is fine since any intersection stops searching
+            assert(stackSize + 2 <= STACKSIZE);
+            stack[stackSize++] = node.offset;
+            stack[stackSize++] = index + 1;
+        }
+        return 0;
+    }
+};
+
+#endif /* BVH_H */
@@ -17,7 +17,9 @@
 
 #include "common.h"
 #include "ray.h"
+#include "sampler.h"
 #include <vector>
+#include <algorithm>
 
 class Camera {
     Point _viewPoint;
@@ -26,6 +28,8 @@ class Camera {
     ELEMTYPE _focalLength; // length from retina to focal plane
     ELEMTYPE _apertureSize; // radius 
     COUNTTYPE _numRays;
+    // each pixel is divided into _aaRatio * _aaRatio strata for anti-aliasing
+    COUNTTYPE _aaRatio;
 
     // spherical coordinate system(radian)
     ELEMTYPE _distanceR; // distance from retina to view Point
@@ -82,25 +86,15 @@ public:
         _viewPoint(vp), _distanceR(d), 
         _retinaLength(rh * rScale), _retinaWidth(rw * rScale),
         _resolutionLength(rh), _resolutionWidth(rw), _refractiveIndex(ri),
-        _angleTheta(0), _anglePhi(0), _numRays(1) {
+        _angleTheta(0), _anglePhi(0), _numRays(1), _aaRatio(1) {
         // disable DOF by default
         retinaChanged();
     }
 
-    // non-DOF function, deprecated
-    Ray getRay(const COUNTTYPE x, const COUNTTYPE y) const {
-        assert(0);
-        assert(x >= 0 && x < resolutionLength());
-        assert(y >= 0 && y < resolutionWidth());
-
-        Vector direction = vertives[topLeft]
-                           + ELEMTYPE(x) / resolutionLength() * (vertives[topRight] - vertives[topLeft])
-                           + ELEMTYPE(y) / resolutionWidth() * (vertives[bottomLeft] - vertives[topLeft]);
-        return Ray(viewPoint(), direction);
-    }
-
     // DOF version
-    std::vector<Ray> getRays(const COUNTTYPE x, const COUNTTYPE y) const {
+    // i-th ray of pixel (x, y), lens and sub-pixel samples are taken from sampler.
+    // with anti-aliasing, ray i is jittered in stratum i % (aaRatio * aaRatio) of the pixel
+    Ray getRay(const COUNTTYPE x, const COUNTTYPE y, const COUNTTYPE i, Sampler& sampler) const {
         /* 
          * x and d' are inclined, from view point to focal point
          * |<-------------x--------------->|
@@ -121,13 +115,27 @@ public:
         */
         assert(x >= 0 && x < resolutionLength());
         assert(y >= 0 && y < resolutionWidth());
-
-        std::vector<Ray> rays;
+        assert(i >= 0 && i < raysPerPixel());
+
+        sampler.startSample(i);
+        ELEMTYPE px = x, py = y;
+        if (_aaRatio > 1) {
+            COUNTTYPE stratum = i % (_aaRatio * _aaRatio);
+            px += (stratum % _aaRatio + sampler.next()) / _aaRatio;
+            py += (stratum / _aaRatio + sampler.next()) / _aaRatio;
+        }
 
         Vector direction = vertives[topLeft]
-                           + ELEMTYPE(x) / resolutionLength() * (vertives[topRight] - vertives[topLeft])
-                           + ELEMTYPE(y) / resolutionWidth() * (vertives[bottomLeft] - vertives[topLeft]);
-        rays.push_back(Ray(viewPoint(), direction, _refractiveIndex));
+                           + px / resolutionLength() * (vertives[topRight] - vertives[topLeft])
+                           + py / resolutionWidth() * (vertives[bottomLeft] - vertives[topLeft]);
+        // the first of every numberRays() rays passes through the center of the lens,
+        // so that all rays do without depth of field
+        if (i % numberRays() == 0) {
+            Ray ray(viewPoint(), direction, _refractiveIndex);
+            ray.setCone(0, pixelSpread());
+            return ray;
+        }
+
         ELEMTYPE dApos = direction.norm();
         direction = direction.normalize();
 
@@ -135,22 +143,31 @@ public:
         Point focalPoint = viewPoint() + (dApos * (distanceR() + focalLength()) 
                                        / distanceR()) * direction;
 
-        for (COUNTTYPE i = 0; i < numberRays() - 1; ++i) {
-            ELEMTYPE randRadius = ELEMTYPE(rand()) / RAND_MAX * apertureSize();
-            ELEMTYPE randAngle1 = ELEMTYPE(rand()) / RAND_MAX * 2 * PI;
-            ELEMTYPE randAngle2 = ELEMTYPE(rand()) / RAND_MAX * 2 * PI;
+        ELEMTYPE randRadius = sampler.next() * apertureSize();
+        ELEMTYPE randAngle1 = sampler.next() * 2 * PI;
+        ELEMTYPE randAngle2 = sampler.next() * 2 * PI;
 
-            Point randPoint(viewPoint()[0] + randRadius * sin(randAngle1) * cos(randAngle2),
-                            viewPoint()[1] + randRadius * sin(randAngle1) * sin(randAngle2),
-                            viewPoint()[2] + randRadius * cos(randAngle1));
+        Point randPoint(viewPoint()[0] + randRadius * sin(randAngle1) * cos(randAngle2),
+                        viewPoint()[1] + randRadius * sin(randAngle1) * sin(randAngle2),
+                        viewPoint()[2] + randRadius * cos(randAngle1));
 
-            rays.push_back(Ray(randPoint, focalPoint - randPoint, _refractiveIndex));
-        }
+        Ray ray(randPoint, focalPoint - randPoint, _refractiveIndex);
+        ray.setCone(0, pixelSpread());
+        return ray;
+    }
 
-        return rays;
+    // rays [first, first + count) of pixel (x, y), written to rays whose storage is reused
+    void getRays(const COUNTTYPE x, const COUNTTYPE y, const COUNTTYPE first, const COUNTTYPE count,
+                 Sampler& sampler, std::vector<Ray>& rays) const {
+        rays.clear();
+        for (COUNTTYPE i = first; i < first + count; ++i)
+            rays.push_back(getRay(x, y, i, sampler));
     }
 
     ELEMTYPE retinaScale() const { return _retinaLength / _resolutionLength; }
+    // angle a stratum of a pixel subtends at the view point, the spread of ray cones.
+    // the retina is 2 * _retinaLength long
+    ELEMTYPE pixelSpread() const { return 2 * retinaScale() / (distanceR() * _aaRatio); }
     COUNTTYPE resolutionLength() const { return _resolutionLength; }
     COUNTTYPE resolutionWidth() const { return _resolutionWidth; }
 
@@ -168,6 +185,10 @@ public:
     ELEMTYPE apertureSize() const { return _apertureSize; }
     void setNumberRays(const COUNTTYPE numRays) { _numRays = numRays; }
     COUNTTYPE numberRays() const { return _numRays; }
+    void setAARatio(const COUNTTYPE aaRatio) { assert(aaRatio > 0); _aaRatio = aaRatio; }
+    COUNTTYPE aaRatio() const { return _aaRatio; }
+    // DOF rays and anti-aliasing strata share the rays of a pixel
+    COUNTTYPE raysPerPixel() const { return std::max(_numRays, _aaRatio * _aaRatio); }
 
 
 };
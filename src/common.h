@@ -30,7 +30,13 @@ using std::flush;
 #include <limits>
 
 namespace RayTracing {
+    // geometry, traversal and colors are computed in ELEMTYPE,
+    // float if built with SINGLE_PRECISION
+#ifdef SINGLE_PRECISION
+    using ELEMTYPE = float;
+#else
     using ELEMTYPE = double;
+#endif
     using COUNTTYPE = int;
     using Vector = Vector3<ELEMTYPE, COUNTTYPE>;
     using Point = Vector3<ELEMTYPE, COUNTTYPE>;
@@ -40,7 +46,7 @@ namespace RayTracing {
     constexpr ELEMTYPE EPSILON = 1e-5;
     const Color blackColor(0, 0, 0);
     const Color whiteColor(255, 255, 255);
-    constexpr ELEMTYPE DOUBLE_MAX = std::numeric_limits<double>::max();
+    constexpr ELEMTYPE ELEMTYPE_MAX = std::numeric_limits<ELEMTYPE>::max();
     constexpr COUNTTYPE maxRecursionDepth = 4;
     constexpr ELEMTYPE ignoreWeight = 1e-1;
     constexpr ELEMTYPE shadowDarkness = 3;
@@ -0,0 +1,102 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: framebuffer.h
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 11:02:15
+ *  Description: Output image divided into tiles. Each tile is traced
+ *               in a small buffer, then written to the image as soon
+ *               as it finishes.
+ *****************************************************************************/
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <algorithm>
+#include "common.h"
+
+using namespace RayTracing;
+
+class FrameBuffer {
+public:
+    // output pixels [x0, x1) * [y0, y1)
+    struct Tile {
+        COUNTTYPE x0, y0, x1, y1;
+        COUNTTYPE length() const { return x1 - x0; }
+        COUNTTYPE width() const { return y1 - y0; }
+
+        // number of positions on the Morton order (Z-order) curve covering the tile
+        COUNTTYPE mortonCount() const {
+            COUNTTYPE side = 1;
+            while (side < length() || side < width()) side <<= 1;
+            return side * side;
+        }
+
+        // k-th pixel of the tile in Morton order, which keeps nearby pixels 
+        // nearby in time. returns false if it falls outside the tile
+        bool mortonPixel(const COUNTTYPE k, COUNTTYPE& x, COUNTTYPE& y) const {
+            // even bits of k are x, odd bits are y
+            x = y = 0;
+            for (COUNTTYPE bit = 0; (k >> 2 * bit) > 0; ++bit) {
+                x |= (k >> 2 * bit & 1) << bit;
+                y |= (k >> (2 * bit + 1) & 1) << bit;
+            }
+            x += x0, y += y0;
+            return x < x1 && y < y1;
+        }
+    };
+
+private:
+    cv::Mat_<cv::Vec3b> _image;
+    COUNTTYPE _tileSize;
+    COUNTTYPE _tilesPerRow;
+    COUNTTYPE _tilesPerColumn;
+
+public:
+    // length * width is the resolution of output image
+    FrameBuffer(const COUNTTYPE length, const COUNTTYPE width, const COUNTTYPE tileSize = 16):
+        _image(width, length), _tileSize(tileSize),
+        _tilesPerRow((length + tileSize - 1) / tileSize),
+        _tilesPerColumn((width + tileSize - 1) / tileSize) {
+        assert(tileSize > 0);
+    }
+
+    COUNTTYPE length() const { return _image.cols; }
+    COUNTTYPE width() const { return _image.rows; }
+    COUNTTYPE tileSize() const { return _tileSize; }
+    COUNTTYPE tileCount() const { return _tilesPerRow * _tilesPerColumn; }
+
+    // tiles are numbered row by row
+    Tile tile(const COUNTTYPE k) const {
+        assert(k >= 0 && k < tileCount());
+        Tile t;
+        t.x0 = k % _tilesPerRow * _tileSize;
+        t.y0 = k / _tilesPerRow * _tileSize;
+        t.x1 = std::min(t.x0 + _tileSize, length());
+        t.y1 = std::min(t.y0 + _tileSize, width());
+        return t;
+    }
+
+    // pixels are row by row, t.length() pixels in each row.
+    // different tiles can be resolved in parallel
+    void resolve(const Tile& t, const std::vector<Color>& pixels) {
+        assert(COUNTTYPE(pixels.size()) >= t.length() * t.width());
+        for (COUNTTYPE y = t.y0; y < t.y1; ++y)
+            for (COUNTTYPE x = t.x0; x < t.x1; ++x) {
+                const Color& color = pixels[(y - t.y0) * t.length() + x - t.x0];
+                // opencv stores pixels in BGR order
+                cv::Vec3b& pixel = _image(y, x);
+                for (COUNTTYPE c = 0; c < 3; ++c)
+                    pixel[2 - c] = std::min(std::max(std::round(color[c]), ELEMTYPE(0)), ELEMTYPE(255));
+            }
+    }
+
+    const cv::Mat_<cv::Vec3b>& image() const { return _image; }
+};
+
+#endif /* FRAMEBUFFER_H */
@@ -10,16 +10,17 @@
  *  Time: 14:53:03
  *  Description: set parameters, get color of each pixel, show on screen
  *****************************************************************************/
-#ifdef _OPENMP
-#include <omp.h>
-#endif
 #include <opencv2/opencv.hpp>
+#include <iostream>
+#include <chrono>
 #include "common.h"
 #include "scene.h"
 #include "camera.h"
 #include "parser.h"
-
-void antiAliasing(cv::Mat_<cv::Vec3b>&, const COUNTTYPE);
+#include "scenefile.h"
+#include "framebuffer.h"
+#include "scheduler.h"
+#include "renderer.h"
 
 int main(int argc, char** argv) {
     using namespace std;
@@ -27,57 +28,142 @@ int main(int argc, char** argv) {
     using namespace RayTracing;
     using RayTracing::Point;
     
-    assert(argc == 4);
+    // raytracing compile scene.objx scene.cmr scene.rts [name=value ...]
+    // writes the built scene to scene.rts, which can be rendered in place of scene.objx
+    bool compile = argc > 1 && string(argv[1]) == "compile";
+    if (compile) ++argv, --argc;
+
+    assert(argc >= 4);
     Scene scene;
-    ObjParser objParser(argv[1], scene);
+    auto loadStart = chrono::steady_clock::now();
+    unique_ptr<ObjParser> objParser;
+    unique_ptr<SceneFile> sceneFile;
+    if (SceneFile::isCompiled(argv[1])) {
+        sceneFile.reset(new SceneFile(argv[1], scene));
+        if (!sceneFile -> good()) {
+            cerr << sceneFile -> error() << endl;
+            return 1;
+        }
+    }
+    else {
+        objParser.reset(new ObjParser(argv[1], scene));
+        for (auto& error: objParser -> errors()) cerr << error << endl;
+        if (objParser -> errorCount() > COUNTTYPE(objParser -> errors().size()))
+            cerr << objParser -> errorCount() - objParser -> errors().size() << " more errors" << endl;
+        if (objParser -> errorCount()) return 1;
+        if (objParser -> skipped()) clog << objParser -> skipped() << " faces of no area skipped" << endl;
+    }
+    clog << "scene loaded in " 
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - loadStart).count() << " ms, "
+         << scene.arena().bytes() / 1024 << " KB in arena" << endl;
     CmrParser cmrParser(argv[2]);
     Camera* camera = cmrParser.getCamera();
-    COUNTTYPE AARatio = cmrParser.aaRatio();
 
-    // image buffer for parallel computing
-    vector< vector< Color > > colorMat(camera -> resolutionWidth(), 
-                                       vector< Color >(camera -> resolutionLength(), 
-                                                       Color(0, 0, 0, 0)));
-#ifdef _OPENMP
-#   pragma omp parallel for num_threads(8) schedule(dynamic)
-#endif
-    // ray trace
-    for (COUNTTYPE j = 0; j < camera -> resolutionWidth(); ++j) {
-        for (COUNTTYPE i = 0; i < camera -> resolutionLength(); ++i) {
-            vector<Ray> rays = camera -> getRays(i, j);
-            Color mixColor(0, 0, 0, 0);
-            for (auto ray: rays) {
-                Color color(0, 0, 0, 0);
-                scene.rayTrace(ray, color);
-                mixColor += color;
-            }
-            colorMat[j][i] = mixColor;
-        }
+    // optional settings given as name=value, override those in camera file
+    for (int i = 4; i < argc; ++i) {
+        string arg(argv[i]);
+        auto pos = arg.find('=');
+        assert(pos != string::npos);
+        cmrParser.setOption(arg.substr(0, pos), arg.substr(pos + 1));
     }
 
-    //copy to oepncv image
-    Mat_<Vec3b> image(camera -> resolutionWidth(), camera -> resolutionLength());
-    auto ite = image.begin();
-    for (auto w: colorMat)
-        for (auto l: w) {
-            (*ite)[0] = l[2], (*ite)[1] = l[1], (*ite)[2] = l[0];
-            ++ite;
+    // acceleration structure: linear, octree or bvh
+    string accelerator = cmrParser.option("accelerator");
+    if (accelerator == "linear") scene.setAccelerator(Scene::LINEAR_SCAN);
+    else if (accelerator == "octree") scene.setAccelerator(Scene::OCTREE_ACCELERATOR);
+    else if (accelerator == "bvh") scene.setAccelerator(Scene::BVH_ACCELERATOR);
+    else assert(accelerator.empty());
+    string octreeDepth = cmrParser.option("octreeDepth");
+    if (octreeDepth.length()) scene.setOctreeMaxDepth(stoi(octreeDepth));
+
+    // limits of paths of secondary rays
+    Scene::PathBudget budget;
+    budget.maxDepth = stoi(cmrParser.option("maxDepth", to_string(budget.maxDepth)));
+    budget.minWeight = stod(cmrParser.option("minWeight", to_string(budget.minWeight)));
+    budget.rouletteWeight = stod(cmrParser.option("rouletteWeight", "0"));
+    budget.maxSecondaryRays = stoi(cmrParser.option("secondaryRays", "0"));
+    scene.setPathBudget(budget);
+
+    // a compiled scene is built already, unless it's asked for another structure
+    if (!scene.isBuilt()) {
+        auto buildStart = chrono::steady_clock::now();
+        scene.build();
+        clog << "acceleration structure built in " 
+             << chrono::duration<double, milli>(chrono::steady_clock::now() - buildStart).count() << " ms, ";
+    }
+    clog << scene.acceleratorNodeCount() << " nodes, depth " << scene.acceleratorDepth() << endl;
+
+    // pictures of textures are decoded in the background since they were parsed
+    auto textureStart = chrono::steady_clock::now();
+    auto textureErrors = TextureCache::instance().wait();
+    for (auto& error: textureErrors) cerr << error << endl;
+    if (textureErrors.size()) return 1;
+    clog << TextureCache::instance().decoded() << " textures decoded, waited " 
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - textureStart).count() << " ms" << endl;
+
+    if (compile) {
+        if (!SceneFile::save(argv[3], scene)) {
+            cerr << argv[3] << ": can't write" << endl;
+            return 1;
         }
+        clog << "compiled to " << argv[3] << endl;
+        return 0;
+    }
 
-    // anti aliasing
-    antiAliasing(image, AARatio);
-    
-    imwrite(argv[3], image);
+    string tileSize = cmrParser.option("tileSize", "16");
+    FrameBuffer frameBuffer(camera -> resolutionLength(), camera -> resolutionWidth(), stoi(tileSize));
+
+    // threads is number of hardware threads if not set
+    // affinity is a cpu list such as 0-7,16-23, threads are not pinned if not set
+    TileScheduler scheduler(stoi(cmrParser.option("threads", "0")),
+                            TileScheduler::parseCpuList(cmrParser.option("affinity")));
+    clog << "rendering with " << scheduler.threadCount() << " threads" << endl;
+
+    Renderer renderer(scene, *camera, frameBuffer);
+    // lens samples: random or halton
+    string samplerType = cmrParser.option("sampler", "random");
+    assert(samplerType == "random" || samplerType == "halton");
+    renderer.setSampler(samplerType == "halton"? Sampler::HALTON: Sampler::RANDOM, 
+                        stoul(cmrParser.option("seed", "0")));
+    // adaptive sampling is disabled if noise threshold is 0
+    renderer.setAdaptiveSampling(stod(cmrParser.option("noiseThreshold", "0")),
+                                 stoi(cmrParser.option("minRays", "8")));
+    // rays traced together in packets, 1 to trace rays one by one
+    renderer.setPacketSize(stoi(cmrParser.option("packetSize", "8")));
+    // secondary rays sorted by direction and origin before they're traced, 1 or 0
+    renderer.setRaySorting(stoi(cmrParser.option("sortRays", "0")));
+    // anti-aliasing: full or edge, edge only takes all rays on pixels differing from neighbors,
+    // others take edgeRays rays, one a stratum if 0
+    string antiAliasing = cmrParser.option("antiAliasing", "full");
+    assert(antiAliasing == "full" || antiAliasing == "edge");
+    renderer.setAntiAliasing(antiAliasing == "edge"? Renderer::EDGE_ADAPTIVE: Renderer::SUPERSAMPLING,
+                             stod(cmrParser.option("edgeThreshold", "16")),
+                             stoi(cmrParser.option("edgeRays", "0")));
+
+    // ray trace tile by tile, only the samples of tiles in progress are kept
+    scheduler.run(frameBuffer.tileCount(), [&](const COUNTTYPE t) { renderer.renderTile(t); });
+
+    // rays actually spent on pixels
+    unsigned long long totalRays = 0, totalPixels = 0;
+    clog << "rays per pixel histogram:";
+    for (size_t k = 0; k < renderer.raysHistogram().size(); ++k) {
+        if (!renderer.raysHistogram()[k]) continue;
+        clog << ' ' << k << ':' << renderer.raysHistogram()[k];
+        totalRays += k * renderer.raysHistogram()[k];
+        totalPixels += renderer.raysHistogram()[k];
+    }
+    clog << endl << "average rays per pixel: " << double(totalRays) / totalPixels << endl;
+    const Scene::Wavefront::Pruned& pruned = renderer.pruned();
+    clog << "secondary rays pruned: " << pruned.depth << " by depth, " << pruned.weight << " by weight, "
+         << pruned.roulette << " by roulette, " << pruned.budget << " by budget" << endl;
+
+    // a primitive in several leaves is tested once a ray, thanks to the mailbox
+    clog << scene.objectTests() << " object tests, " 
+         << scene.duplicateTestsAvoided() << " duplicate tests avoided" << endl;
+
+    imwrite(argv[3], frameBuffer.image());
     //namedWindow("Preview");
-    //imshow("Preview", image);
+    //imshow("Preview", frameBuffer.image());
     //waitKey(0);
     return 0;
 }
-
-void antiAliasing(cv::Mat_<cv::Vec3b>& image, const COUNTTYPE aaRatio) {
-    if (aaRatio != 1)
-        cv::resize(image, image, 
-                   cv::Size(image.cols / aaRatio, image.rows / aaRatio),
-                   0, 0, cv::INTER_AREA);
-}
-
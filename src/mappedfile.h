@@ -0,0 +1,79 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: mappedfile.h
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 23:58:02
+ *  Description: A whole file mapped into memory read only, or read into
+ *               a buffer where it can't be mapped.
+ *****************************************************************************/
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iterator>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+    const char* _data;
+    size_t _size;
+    bool _mapped;
+    std::vector<char> buffer; // the file if it isn't mapped
+
+public:
+    // good() is false if the file can't be opened
+    explicit MappedFile(const std::string& filename): _data(nullptr), _size(0), _mapped(0) {
+#ifdef __linux__
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                _data = static_cast<const char*>(p);
+                _size = st.st_size;
+                _mapped = 1;
+                // read front to back
+                madvise(p, _size, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+        if (_mapped) return;
+#endif
+        std::ifstream fin(filename.c_str(), std::ios::binary);
+        if (!fin.is_open()) return;
+        buffer.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+        // empty files are good too
+        buffer.push_back(0);
+        _data = buffer.data();
+        _size = buffer.size() - 1;
+    }
+
+    ~MappedFile() {
+#ifdef __linux__
+        if (_mapped) munmap(const_cast<char*>(_data), _size);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool good() const { return _data; }
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+    const char* begin() const { return _data; }
+    const char* end() const { return _data + _size; }
+};
+
+#endif /* MAPPEDFILE_H */
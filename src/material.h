@@ -34,6 +34,8 @@ class Material {
                          // is larger for surfaces that are smoother and more mirror-like. 
                          // When this constant is large the specular highlight is small.
     bool _transparent;
+    // depth of secondary rays spawned on this material, -1 if only the scene limits it
+    COUNTTYPE _maxDepth;
 
 public:
     Material(const Color& c,
@@ -45,7 +47,7 @@ public:
         _ambientCoefficient(ac), _diffuseReflectivity(dr),
         _specularReflectivity(sr), _shininess(s),
         _refractiveIndex(r), _reflectionWeight(rlw),
-        _refractionWeight(rrw), _transparent(tp) {
+        _refractionWeight(rrw), _transparent(tp), _maxDepth(-1) {
     }
 
     void setColor(const Color& c) { _color = c; }
@@ -66,6 +68,8 @@ public:
     ELEMTYPE shininess() const { return _shininess; }
     void setTransparent(const bool t) { _transparent = t; }
     bool isTransparent() const { return _transparent; }
+    void setMaxDepth(const COUNTTYPE d) { _maxDepth = d; }
+    COUNTTYPE maxDepth() const { return _maxDepth; }
 };
 
 #endif /* MATERIAL_H */
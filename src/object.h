@@ -17,25 +17,84 @@
 #include "ray.h"
 #include "texture.h"
 #include "material.h"
+#include <algorithm>
+#include <limits>
 
 using namespace RayTracing;
 
+class Object;
+
+// where a ray hits an object, found once and passed through shading
+struct Hit {
+    const Object* object;
+    ELEMTYPE distance;
+    // the triangle of a rectangle, twice the face plus its triangle
+    // for a mesh, 0 for other objects
+    COUNTTYPE primitive;
+    // index of the material of object in the material table
+    COUNTTYPE material;
+    // filled by Object::fillHit
+    Point point;
+    Vector normal; // unit geometric normal
+    ELEMTYPE u, v; // texture coordinates
+    // width of the ray cone where it meets the surface, stretched by the slant
+    ELEMTYPE footprint;
+    Hit(): object(nullptr), distance(ELEMTYPE_MAX), primitive(0), material(0), u(0), v(0), footprint(0) { }
+
+    // point moved off the surface along the normal, to the side of direction,
+    // by many times the rounding error of point, which grows with the distances 
+    // and coordinates involved. rays leaving from it don't hit the surface again
+    // in either precision, unlike with a fixed offset.
+    // it's also moved by as much, or EPSILON if that's more, along the unit vector
+    // along, back the way a ray reached point or on along it for refraction. the point
+    // then stays on the side of other surfaces meeting this one, such as the other
+    // wall at a corner, that the ray was on
+    Point offset(const Vector& direction, const Vector& along) const {
+        ELEMTYPE scale = distance;
+        for (COUNTTYPE k = 0; k < 3; ++k) scale = std::max(scale, std::abs(point[k]));
+        ELEMTYPE delta = 256 * std::numeric_limits<ELEMTYPE>::epsilon() * std::max(scale, ELEMTYPE(1));
+        return point + (normal * direction < 0? -delta: delta) * normal + std::max(delta, EPSILON) * along;
+    }
+};
+
 class Object {
+public:
+    enum INTERSECTED_TYPE { INTERSECTED_IN = -1, MISS = 0, INTERSECTED = 1 };
+    // objects are of these types only, calls are dispatched on the type
+    // to the derived class (in objects.h) so they can be inlined
+    enum OBJECT_TYPE { SPHERE = 0, TRIANGLE = 1, RECTANGLE = 2, MESH = 3 };
+
 protected:
+    const OBJECT_TYPE _type;
     const Material* _material;
     const Texture* _texture;
-public:
-    enum INTERSECTED_TYPE { INTERSECTED_IN = -1, MISS = 0, INTERSECTED = 1 };
+    // axis aligned bounding box, set by the derived class
+    ELEMTYPE _lowerBound[3];
+    ELEMTYPE _upperBound[3];
 
-    Object(const Material* mat, const Texture* tex): 
-        _material(mat), _texture(tex) { }
+    Object(const OBJECT_TYPE type, const Material* mat, const Texture* tex): 
+        _type(type), _material(mat), _texture(tex) { }
 
+    void setBounds(const Point& lower, const Point& upper) {
+        for (COUNTTYPE k = 0; k < 3; ++k) {
+            _lowerBound[k] = lower[k];
+            _upperBound[k] = upper[k];
+        }
+    }
+
+public:
     virtual ~Object() { }
-    virtual Vector normal(const Point&) const = 0;
-    virtual INTERSECTED_TYPE isIntersected(const Ray&, ELEMTYPE& distance) const = 0;
+
+    OBJECT_TYPE type() const { return _type; }
+    INTERSECTED_TYPE isIntersected(const Ray&, ELEMTYPE& distance) const;
+    // fills point, normal, texture coordinates and footprint of hit of ray,
+    // whose object, distance and primitive are found
+    void fillHit(const Ray&, Hit&) const;
 
     void setTexture(const Texture* t) { _texture = t; }
     void setMaterial(const Material* mat) { _material = mat; }
+    const Material* material() const { return _material; }
+    const Texture* texture() const { return _texture; }
 
     ELEMTYPE reflectionWeight() const { return _material -> reflectionWeight(); }
     ELEMTYPE refractionWeight() const { return _material -> refractionWeight(); }
@@ -46,14 +105,15 @@ public:
     ELEMTYPE shininess() const { return _material -> shininess(); }
     bool isTransparent() const { return _material -> isTransparent(); }
 
-    virtual Color texture(const Point&) const = 0;
-    virtual Color color() const = 0; 
-    virtual ELEMTYPE lowerBoundX() const = 0;
-    virtual ELEMTYPE upperBoundX() const = 0;
-    virtual ELEMTYPE lowerBoundY() const = 0;
-    virtual ELEMTYPE upperBoundY() const = 0;
-    virtual ELEMTYPE lowerBoundZ() const = 0;
-    virtual ELEMTYPE upperBoundZ() const = 0;
+    // color of the texture at hit, the color of material if there isn't a texture
+    Color texture(const Hit&) const;
+    Color color() const { return _material -> color(); }
+    ELEMTYPE lowerBoundX() const { return _lowerBound[0]; }
+    ELEMTYPE upperBoundX() const { return _upperBound[0]; }
+    ELEMTYPE lowerBoundY() const { return _lowerBound[1]; }
+    ELEMTYPE upperBoundY() const { return _upperBound[1]; }
+    ELEMTYPE lowerBoundZ() const { return _lowerBound[2]; }
+    ELEMTYPE upperBoundZ() const { return _upperBound[2]; }
     // TODO: virtual change position
     // implement if necessary
 };
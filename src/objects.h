@@ -0,0 +1,99 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: objects.h
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 21:08:47
+ *  Description: All types of objects. Calls of Object are dispatched on
+ *               its type to the derived class here, where they are all
+ *               known, instead of through virtual functions.
+ *****************************************************************************/
+#ifndef OBJECTS_H
+#define OBJECTS_H
+
+#include "common.h"
+#include "object.h"
+#include "sphere.h"
+#include "triangle.h"
+#include "rectangle.h"
+#include "trianglemesh.h"
+
+using namespace RayTracing;
+
+inline Object::INTERSECTED_TYPE Object::isIntersected(const Ray& ray, ELEMTYPE& distance) const {
+    switch (_type) {
+        case SPHERE: return static_cast<const Sphere*>(this) -> isIntersected(ray, distance);
+        case TRIANGLE: return static_cast<const Triangle*>(this) -> isIntersected(ray, distance);
+        case RECTANGLE: return static_cast<const Rectangle*>(this) -> isIntersected(ray, distance);
+        case MESH: return static_cast<const TriangleMesh*>(this) -> isIntersected(ray, distance);
+    }
+    assert(0); // should never happen
+    return MISS;
+}
+
+inline void Object::fillHit(const Ray& ray, Hit& hit) const {
+    switch (_type) {
+        case SPHERE: static_cast<const Sphere*>(this) -> fillHit(ray, hit); break;
+        case TRIANGLE: static_cast<const Triangle*>(this) -> fillHit(ray, hit); break;
+        case RECTANGLE: static_cast<const Rectangle*>(this) -> fillHit(ray, hit); break;
+        case MESH: static_cast<const TriangleMesh*>(this) -> fillHit(ray, hit); break;
+        default: assert(0); // should never happen
+    }
+    // grazing rays are stretched at most 16 times
+    ELEMTYPE cosine = std::max(std::abs(ray.direction() * hit.normal), ELEMTYPE(1.0 / 16));
+    hit.footprint = ray.footprint(hit.distance) / cosine;
+}
+
+inline Color Object::texture(const Hit& hit) const {
+    // faces of a mesh have their own materials
+    if (_type == MESH) return static_cast<const TriangleMesh*>(this) -> texture(hit);
+    if (!_texture) return color();
+    switch (_type) {
+        case SPHERE: return static_cast<const Sphere*>(this) -> texture(hit);
+        case TRIANGLE: return static_cast<const Triangle*>(this) -> texture(hit);
+        case RECTANGLE: return static_cast<const Rectangle*>(this) -> texture(hit);
+        default: break;
+    }
+    assert(0); // should never happen
+    return color();
+}
+
+// what acceleration structures are built of, an object or a face of a mesh.
+// the bounding box of a face is found when it's asked for
+class Primitive {
+    const Object* _object;
+    COUNTTYPE _face;
+
+    ELEMTYPE bound(const COUNTTYPE k, const bool upper) const {
+        if (_object -> type() != Object::MESH) {
+            switch (k) {
+                case 0: return upper? _object -> upperBoundX(): _object -> lowerBoundX();
+                case 1: return upper? _object -> upperBoundY(): _object -> lowerBoundY();
+                default: return upper? _object -> upperBoundZ(): _object -> lowerBoundZ();
+            }
+        }
+        Point lower, upperPoint;
+        static_cast<const TriangleMesh*>(_object) -> faceBounds(_face, lower, upperPoint);
+        return upper? upperPoint[k]: lower[k];
+    }
+
+public:
+    Primitive(const Object* obj, const COUNTTYPE face): _object(obj), _face(face) { }
+
+    const Object* object() const { return _object; }
+    // the face of a mesh, 0 for other objects
+    COUNTTYPE face() const { return _face; }
+
+    ELEMTYPE lowerBoundX() const { return bound(0, 0); }
+    ELEMTYPE upperBoundX() const { return bound(0, 1); }
+    ELEMTYPE lowerBoundY() const { return bound(1, 0); }
+    ELEMTYPE upperBoundY() const { return bound(1, 1); }
+    ELEMTYPE lowerBoundZ() const { return bound(2, 0); }
+    ELEMTYPE upperBoundZ() const { return bound(2, 1); }
+};
+
+#endif /* OBJECTS_H */
@@ -13,6 +13,8 @@
 #ifndef OCTREE_H
 #define OCTREE_H
 #include <vector>
+#include <limits>
+#include <algorithm>
 #include <assert.h>
 #include <cmath>
 
@@ -21,330 +23,476 @@
 // ELEMTYPE: type of coordinate, such as int, float, double...
 // INTTYPE: integer type, such as int, long ...
 // REALTYPE: type fof coordinate for use of calculation, such as float, double...
+// MAXOBJCOUNT: a node with no more objects than this is not split
 
 
 template < class DATATYPE, class ELEMTYPE, class INTTYPE, class REALTYPE, INTTYPE MAXOBJCOUNT >
-class TreeNode {
-    class LeafNode {
-        std::vector< const DATATYPE* > objects;
-
-    public:
-        INTTYPE size() const { return objects.size(); }
-        void insert(const DATATYPE* obj) {
-            objects.push_back(obj);
-        }
-        const DATATYPE* operator[](const INTTYPE i) const {
-            assert(i < size());
-            return objects[i];
-        }
+class Octree {
+    // surfaces of a cube, axis of surface s is s / 2, 
+    // surfaces with even index face the positive direction
+    enum Surface { None = -1, Front = 0, Back, Right, Left, Up, Down };
+
+    // node of the tree, all nodes are stored in one array
+    struct FlatNode {
+        ELEMTYPE minBound[3];
+        ELEMTYPE maxBound[3];
+        // children are nodes[firstChild, firstChild + 8), 0 if I'm a leaf node
+        // child i is in the upper half of axis k if bit k of i is set
+        INTTYPE firstChild;
+        // objects in a leaf node are flatObjects[objectOffset, objectOffset + objectCount)
+        INTTYPE objectOffset;
+        INTTYPE objectCount;
+        // neighbor node on the other side of each surface, -1 if none
+        INTTYPE ropes[6];
+
+        bool isLeafNode() const { return !firstChild; }
     };
 
-    LeafNode* leafnode;
-    TreeNode* subtree[8];
-    TreeNode* parentTree;
-    TreeNode* rootNode;
-    ELEMTYPE minX, minY, minZ, maxX, maxY, maxZ;
-    enum Surface { None = -1, Front = 0, Back, Left, Right, Up, Down };
+    struct BoundingBox {
+        ELEMTYPE minBound[3];
+        ELEMTYPE maxBound[3];
+    };
+
+    // relative cost of traversing a node and intersecting an object
+    constexpr static REALTYPE TRAVERSALCOST = 1;
+    constexpr static REALTYPE INTERSECTIONCOST = 2;
     constexpr static ELEMTYPE EPSILON = 1e-5;
 
-    bool intersectRange(const ELEMTYPE minx, const ELEMTYPE miny, const ELEMTYPE minz,
-                        const ELEMTYPE maxx, const ELEMTYPE maxy, const ELEMTYPE maxz) const {
-        return std::max(minx, minX) < std::min(maxx, maxX) &&
-               std::max(miny, minY) < std::min(maxy, maxY) && 
-               std::max(minz, minZ) < std::min(maxz, maxZ);
-    }
-    
-    bool inRange(const ELEMTYPE x, const ELEMTYPE y, const ELEMTYPE z) const {
-        return (x >= minX && x <= maxX && 
-                y >= minY && y <= maxY &&
-                z >= minZ && z <= maxZ);
+    std::vector< const DATATYPE* > objects;
+    std::vector< BoundingBox > objectBoxes;
+    std::vector< FlatNode > flatNodes;
+    std::vector< const DATATYPE* > flatObjects;
+    // index in objects of each element in flatObjects
+    std::vector< INTTYPE > flatObjectIds;
+    INTTYPE _maxDepth;
+    INTTYPE _depth;
+    bool built;
+
+    // a box touching the cell only on the cell's surface doesn't overlap with it,
+    // unless the box is flat in that axis
+    static bool overlap(const BoundingBox& box, const FlatNode& node) {
+        for (INTTYPE k = 0; k < 3; ++k) {
+            if (box.minBound[k] > node.maxBound[k] || box.maxBound[k] < node.minBound[k])
+                return 0;
+            if (box.minBound[k] < box.maxBound[k] && 
+                (box.minBound[k] == node.maxBound[k] || box.maxBound[k] == node.minBound[k]))
+                return 0;
+        }
+        return 1;
     }
 
-    bool intersectSurface(const ELEMTYPE pointX, const ELEMTYPE pointY, const ELEMTYPE pointZ,
-                          const ELEMTYPE direcX, const ELEMTYPE direcY, const ELEMTYPE direcZ,
-                          ELEMTYPE& interX, ELEMTYPE& interY, ELEMTYPE& interZ,
-                          const Surface surface) const {
-        assert(std::abs(pow(direcX, 2) + pow(direcY, 2) + pow(direcZ, 2) - 1) < EPSILON);
-        ELEMTYPE n[3]; // normal of the surface
-        ELEMTYPE a[3]; // any vertex of the surface
-        switch (surface) {
-            case Front:
-                n[0] =  1, n[1] = n[2] = 0;
-                a[0] = maxX, a[1] = minY, a[2] = minZ;
-                break;
-            case Back:
-                n[0] = -1, n[1] = n[2] = 0;
-                a[0] = minX, a[1] = minY, a[2] = minZ;
-                break;
-            case Left:
-                n[1] = -1, n[0] = n[2] = 0;
-                a[0] = minX, a[1] = minY, a[2] = minZ;
-                break;
-            case Right:
-                n[1] =  1, n[0] = n[2] = 0;
-                a[0] = minX, a[1] = maxY, a[2] = minZ;
-                break;
-            case Up:
-                n[2] =  1, n[0] = n[1] = 0;
-                a[0] = minX, a[1] = minY, a[2] = maxZ;
-                break;
-            case Down:
-                n[2] = -1, n[0] = n[1] = 0;
-                a[0] = minX, a[1] = minY, a[2] = minZ;
-                break;
-            default:
-                // should never happen
-                assert(0);
+    // splits flatNodes[index] which contains objects[objectIndices] top-down
+    void buildRecursive(const INTTYPE index, const std::vector<INTTYPE>& objectIndices, 
+                        const INTTYPE depth) {
+        _depth = std::max(_depth, depth);
+        INTTYPE count = objectIndices.size();
+        flatNodes[index].firstChild = 0;
+        flatNodes[index].objectOffset = flatObjects.size();
+        flatNodes[index].objectCount = 0;
+
+        std::vector<INTTYPE> childObjects[8];
+        bool split = count > MAXOBJCOUNT && depth < _maxDepth;
+        if (split) {
+            ELEMTYPE mid[3];
+            for (INTTYPE k = 0; k < 3; ++k) 
+                mid[k] = (REALTYPE(flatNodes[index].minBound[k]) + flatNodes[index].maxBound[k]) / 2;
+
+            FlatNode children[8];
+            INTTYPE childCount = 0;
+            for (INTTYPE i = 0; i < 8; ++i) {
+                for (INTTYPE k = 0; k < 3; ++k) {
+                    children[i].minBound[k] = i >> k & 1? mid[k]: flatNodes[index].minBound[k];
+                    children[i].maxBound[k] = i >> k & 1? flatNodes[index].maxBound[k]: mid[k];
+                }
+                for (auto obj: objectIndices)
+                    if (overlap(objectBoxes[obj], children[i])) 
+                        childObjects[i].push_back(obj);
+                childCount += childObjects[i].size();
+            }
+
+            // a ray passing through a cell hits a quarter of its children's surface area,
+            // don't split if objects are duplicated into children so much it doesn't pay off
+            REALTYPE splitCost = TRAVERSALCOST + INTERSECTIONCOST * childCount / 4;
+            REALTYPE leafCost = INTERSECTIONCOST * count;
+            split = splitCost < leafCost;
+
+            if (split) {
+                INTTYPE firstChild = flatNodes.size();
+                flatNodes.insert(flatNodes.end(), children, children + 8);
+                flatNodes[index].firstChild = firstChild;
+                for (INTTYPE i = 0; i < 8; ++i) {
+                    buildRecursive(firstChild + i, childObjects[i], depth + 1);
+                    std::vector<INTTYPE>().swap(childObjects[i]);
+                }
+                return;
+            }
         }
 
-        REALTYPE PPapos = REALTYPE(a[0] - pointX) * n[0] + 
-                          REALTYPE(a[1] - pointY) * n[1] + 
-                          REALTYPE(a[2] - pointZ) * n[2];
-
-        REALTYPE PDapos = PPapos / (direcX * n[0] + direcY * n[1] + direcZ * n[2]);
-        ELEMTYPE D[3];
-        // D[3] is intersection point
-        D[0] = PDapos * direcX + pointX;
-        D[1] = PDapos * direcY + pointY;
-        D[2] = PDapos * direcZ + pointZ;
-        interX = D[0], interY = D[1], interZ = D[2];
-
-        switch (surface) {
-            case Front:
-                assert(std::abs(D[0] - maxX) < EPSILON);
-                if (D[1] >= minY && D[1] <= maxY && D[2] >= minZ && D[2] <= maxZ) 
-                    return 1;
-                else return 0;
-            case Back:
-                assert(std::abs(D[0] - minX) < EPSILON);
-                if (D[1] >= minY && D[1] <= maxY && D[2] >= minZ && D[2] <= maxZ) 
-                    return 1;
-                else return 0;
-            case Left:
-                assert(std::abs(D[1] - minY) < EPSILON);
-                if (D[0] >= minX && D[0] <= maxX && D[2] >= minZ && D[2] <= maxZ) 
-                    return 1;
-                else return 0;
-            case Right:
-                assert(std::abs(D[1] - maxY) < EPSILON);
-                if (D[0] >= minX && D[0] <= maxX && D[2] >= minZ && D[2] <= maxZ) 
-                    return 1;
-                else return 0;
-            case Up:
-                assert(std::abs(D[2] - maxZ) < EPSILON);
-                if (D[0] >= minX && D[0] <= maxX && D[1] >= minY && D[1] <= maxY) 
-                    return 1;
-                else return 0; 
-            case Down:
-                assert(std::abs(D[2] - minZ) < EPSILON);
-                if (D[0] >= minX && D[0] <= maxX && D[1] >= minY && D[1] <= maxY) 
-                    return 1;
-                else return 0; 
-            default:
-                assert(0);
+        for (auto obj: objectIndices) {
+            flatObjects.push_back(objects[obj]);
+            flatObjectIds.push_back(obj);
         }
+        flatNodes[index].objectCount = count;
     }
 
-public:
-    TreeNode(const ELEMTYPE minx, const ELEMTYPE miny, const ELEMTYPE minz,
-             const ELEMTYPE maxx, const ELEMTYPE maxy, const ELEMTYPE maxz,   
-             TreeNode* parent): 
-        minX(minx), minY(miny), minZ(minz), 
-        maxX(maxx), maxY(maxy), maxZ(maxz),
-        parentTree(parent), leafnode(0) {
-        assert(minx < maxx && miny < maxy && minz < maxz);
-        memset(subtree, 0, sizeof(TreeNode*) * 8);
-        leafnode = new LeafNode;
-        rootNode = (parent? parent -> rootNode: this);
+    // child of nodes[index] which contains point p, 
+    // points on the splitting plane go to the side the ray is heading to
+    INTTYPE childContaining(const INTTYPE index, const REALTYPE p[3], const REALTYPE d[3]) const {
+        const FlatNode& node = flatNodes[index];
+        // upper bound of the first child is the middle of the node
+        const FlatNode& lowerChild = flatNodes[node.firstChild];
+        INTTYPE childIndex = 0;
+        for (INTTYPE k = 0; k < 3; ++k)
+            if (p[k] > lowerChild.maxBound[k] || (p[k] == lowerChild.maxBound[k] && d[k] > 0))
+                childIndex |= 1 << k;
+        return node.firstChild + childIndex;
     }
 
-    ~TreeNode() {
-        delete leafnode;
-        leafnode = 0;
-        for (INTTYPE i = 0; i < 8; ++i) { delete subtree[i]; subtree[i] = 0; }
+    // neighbor across surface s of nodes[index] is rope,
+    // find the smallest node that still covers the whole surface
+    INTTYPE optimizeRope(const INTTYPE index, const Surface s, INTTYPE rope) const {
+        const FlatNode& node = flatNodes[index];
+        const INTTYPE axis = s / 2;
+        // any axis parallel to the surface, cells are cubes
+        const INTTYPE tangent = (axis + 1) % 3;
+        const ELEMTYPE size = node.maxBound[tangent] - node.minBound[tangent];
+        REALTYPE center[3], toward[3] = { 0, 0, 0 };
+        for (INTTYPE k = 0; k < 3; ++k)
+            center[k] = (REALTYPE(node.minBound[k]) + node.maxBound[k]) / 2;
+        center[axis] = s % 2? node.minBound[axis]: node.maxBound[axis];
+        toward[axis] = s % 2? -1: 1;
+
+        while (rope >= 0 && !flatNodes[rope].isLeafNode()) {
+            const FlatNode& neighbor = flatNodes[rope];
+            if (neighbor.maxBound[tangent] - neighbor.minBound[tangent] < 1.5 * size) break;
+            rope = childContaining(rope, center, toward);
+        }
+        return rope;
     }
 
-    bool isRoot() const { return !parentTree; }
-    
-    bool isLeafNode() const {
-        bool hasSubtree = 0;
-        for (INTTYPE i = 0; i < 8; ++i) if (subtree[i]) hasSubtree = 1;
-        assert(bool(leafnode) ^ hasSubtree);
-        return leafnode;
+    void buildRopes(const INTTYPE index, const INTTYPE ropes[6]) {
+        for (INTTYPE s = Front; s <= Down; ++s)
+            flatNodes[index].ropes[s] = optimizeRope(index, Surface(s), ropes[s]);
+        if (flatNodes[index].isLeafNode()) return;
+
+        const INTTYPE firstChild = flatNodes[index].firstChild;
+        for (INTTYPE i = 0; i < 8; ++i) {
+            INTTYPE childRopes[6];
+            for (INTTYPE k = 0; k < 3; ++k) {
+                bool upper = i >> k & 1;
+                INTTYPE sibling = firstChild + (i ^ 1 << k);
+                // surfaces inside the parent lead to siblings
+                childRopes[2 * k] = upper? flatNodes[index].ropes[2 * k]: sibling;
+                childRopes[2 * k + 1] = upper? sibling: flatNodes[index].ropes[2 * k + 1];
+            }
+            buildRopes(firstChild + i, childRopes);
+        }
     }
 
-    INTTYPE size() const {
-        if (leafnode) 
-            return leafnode -> size();
-        INTTYPE sz = 0;
-        for (INTTYPE i = 0; i < 8; ++i)
-            sz += subtree[i] -> size();
-        return sz;
+    // leaf node containing point p, starting from nodes[index]
+    INTTYPE locateLeaf(INTTYPE index, const REALTYPE p[3], const REALTYPE d[3]) const {
+        while (!flatNodes[index].isLeafNode())
+            index = childContaining(index, p, d);
+        return index;
     }
 
-    bool insert(const DATATYPE* obj) {
-    // returns false if obj doesn't intersect with my range
-    // returns true if inserting successfully
-        ELEMTYPE minx = obj -> lowerBoundX();
-        ELEMTYPE maxx = obj -> upperBoundX();
-        ELEMTYPE miny = obj -> lowerBoundY();
-        ELEMTYPE maxy = obj -> upperBoundY();
-        ELEMTYPE minz = obj -> lowerBoundZ();
-        ELEMTYPE maxz = obj -> upperBoundZ();
-
-        if (!intersectRange(minx, miny, minz, maxx, maxy, maxz)) return 0;
-        // try to insert to subtrees
-        if (!isLeafNode()) {
-            bool rtv = 0;
-            for (INTTYPE i = 0; i < 8; ++i) 
-                if (subtree[i] -> insert(obj)) {
-                    rtv = 1;
-                }
-            assert(rtv);
-            return 1;
+    template < class VISITFUNC >
+    // visits leaf cells the ray passes through from near to far, 
+    // stops when visit returns true or the ray goes beyond distance tMax
+    // visit(cell, distance at which the ray leaves the cell)
+    void traverse(const REALTYPE o[3], const REALTYPE d[3], const REALTYPE tMax, 
+                  VISITFUNC visit) const {
+        REALTYPE invDirection[3];
+        for (INTTYPE k = 0; k < 3; ++k) invDirection[k] = REALTYPE(1) / d[k];
+
+        // clip the ray by the root cell
+        REALTYPE tEntry = 0, tExit = tMax;
+        for (INTTYPE k = 0; k < 3; ++k) {
+            REALTYPE t0 = (flatNodes[0].minBound[k] - o[k]) * invDirection[k];
+            REALTYPE t1 = (flatNodes[0].maxBound[k] - o[k]) * invDirection[k];
+            if (t0 > t1) std::swap(t0, t1);
+            tEntry = std::max(tEntry, t0);
+            tExit = std::min(tExit, t1);
         }
-        else if (leafnode) {
-            leafnode -> insert(obj);
-            if (leafnode -> size() < MAXOBJCOUNT) return 1;
-            // if exceed size upper bound, split
-            ELEMTYPE midX = REALTYPE(minX + maxX) / 2;
-            ELEMTYPE midY = REALTYPE(minY + maxY) / 2;
-            ELEMTYPE midZ = REALTYPE(minZ + maxZ) / 2;
-            subtree[0] = new TreeNode(minX, minY, minZ, midX, midY, midZ, this);
-            subtree[1] = new TreeNode(midX, minY, minZ, maxX, midY, midZ, this);
-            subtree[2] = new TreeNode(minX, midY, minZ, midX, maxY, midZ, this);
-            subtree[3] = new TreeNode(midX, midY, minZ, maxX, maxY, midZ, this);
-            subtree[4] = new TreeNode(minX, minY, midZ, midX, midY, maxZ, this);
-            subtree[5] = new TreeNode(midX, minY, midZ, maxX, midY, maxZ, this);
-            subtree[6] = new TreeNode(minX, midY, midZ, midX, maxY, maxZ, this);
-            subtree[7] = new TreeNode(midX, midY, midZ, maxX, maxY, maxZ, this);
-            for (INTTYPE i = 0; i < 8; ++i)
-                for (INTTYPE j = 0; j < leafnode -> size(); ++j)
-                    subtree[i] -> insert((*leafnode)[j]);
-            delete leafnode;
-            leafnode = 0;
-            return 1;
+        if (tEntry > tExit) return;
+
+        REALTYPE p[3];
+        for (INTTYPE k = 0; k < 3; ++k) p[k] = o[k] + tEntry * d[k];
+        INTTYPE index = locateLeaf(0, p, d);
+
+        while (1) {
+            const FlatNode& node = flatNodes[index];
+            // find out the surface the ray leaves from
+            Surface exitSurface = None;
+            tExit = std::numeric_limits<REALTYPE>::max();
+            for (INTTYPE k = 0; k < 3; ++k) {
+                if (d[k] == 0) continue;
+                REALTYPE t = ((d[k] > 0? node.maxBound[k]: node.minBound[k]) - o[k]) * invDirection[k];
+                if (t < tExit) tExit = t, exitSurface = Surface(2 * k + (d[k] < 0));
+            }
+            assert(exitSurface != None);
+
+            if (visit(node, tExit) || tExit >= tMax) return;
+
+            index = node.ropes[exitSurface];
+            if (index < 0) return;
+            for (INTTYPE k = 0; k < 3; ++k) p[k] = o[k] + tExit * d[k];
+            index = locateLeaf(index, p, d);
         }
+    }
+
+public:
+    Octree(): _maxDepth(16), _depth(0), built(0) { }
 
-        // should never happen
-        assert(0);
+    INTTYPE size() const { return flatObjects.size(); }
+    INTTYPE nodeCount() const { return flatNodes.size(); }
+    INTTYPE depth() const { return _depth; }
+    void setMaxDepth(const INTTYPE d) { assert(d >= 0); _maxDepth = d; }
+    INTTYPE maxDepth() const { return _maxDepth; }
+
+    void clear() {
+        objects.clear();
+        objectBoxes.clear();
+        flatNodes.clear();
+        flatObjects.clear();
+        flatObjectIds.clear();
+        _depth = 0;
+        built = 0;
     }
 
-    template < class CALLBACKFUNC >
-    // (ox, oy, oz) starting point coordinate
-    // (dx, dy, dz) direction
-    // assert (ox, oy, oz) in its range
-    bool search(const ELEMTYPE ox, const ELEMTYPE oy, const ELEMTYPE oz,
-                const ELEMTYPE dx, const ELEMTYPE dy, const ELEMTYPE dz,
-                CALLBACKFUNC func) const {
-    // call back function
-    // returns false if not found, continue seaching.
-    // returns ture if found, stop searching at once.
-        // if starting point isn't in my range
-        if (!inRange(ox, oy, oz)) return 0;
-        // traverse all objects stored in me if I'm a leaf node
-        if (isLeafNode()) {
-            // traverse all objects stored in leaf node
-            bool found = 0;
-            for (INTTYPE i = 0; i < leafnode -> size(); ++i) {
-                ELEMTYPE distance;
-                if (func((*leafnode)[i], distance) &&  // if found
-                    inRange(ox + dx * distance, // intersection point is in my range
-                            oy + dy * distance,
-                            oz + dz * distance)) 
-                // have to traverse every objects,
-                // because their overlapping sequence is uncertain.
-                    found = 1;
-            }
-            if (found) 
-                return 1;
-            // not found after traversing
-            // find the next cube the vector passes through
-            // and search in that cube
-            
-            // find out the vector intersects with which surface
-            ELEMTYPE interPoint[3];
-            Surface surfaces[3];
-            surfaces[0] = dx > 0? Front: (dx < 0? Back: None);
-            surfaces[1] = dy > 0? Right: (dy < 0? Left: None);
-            surfaces[2] = dz > 0? Up: (dz < 0? Down: None);
-
-            for (INTTYPE i = 0; i < 3; ++i) {
-                if (surfaces[i] == None) continue;
-                bool intersected = intersectSurface(ox, oy, oz, dx, dy, dz,
-                                                    interPoint[0],
-                                                    interPoint[1],
-                                                    interPoint[2],
-                                                    surfaces[i]);
-                if (intersected) {
-                    return rootNode -> search(interPoint[0] + EPSILON * dx,
-                                              interPoint[1] + EPSILON * dy,
-                                              interPoint[2] + EPSILON * dz,
-                                              dx, dy, dz, func);
-                }
+    void insert(const DATATYPE* obj) {
+        BoundingBox box;
+        box.minBound[0] = obj -> lowerBoundX();
+        box.minBound[1] = obj -> lowerBoundY();
+        box.minBound[2] = obj -> lowerBoundZ();
+        box.maxBound[0] = obj -> upperBoundX();
+        box.maxBound[1] = obj -> upperBoundY();
+        box.maxBound[2] = obj -> upperBoundZ();
+        objects.push_back(obj);
+        objectBoxes.push_back(box);
+        built = 0;
+    }
+
+    // builds the tree in one array over the bounding box of all objects, 
+    // and links neighbor cells.
+    // must be called after all objects are inserted and before searching
+    void build() {
+        flatNodes.clear();
+        flatObjects.clear();
+        flatObjectIds.clear();
+        _depth = 0;
+
+        // root cell fits the scene, slightly enlarged so no object touches its surfaces
+        FlatNode root;
+        ELEMTYPE maxExtent = 0;
+        for (INTTYPE k = 0; k < 3; ++k) {
+            root.minBound[k] = objects.size()? std::numeric_limits<ELEMTYPE>::max(): -1;
+            root.maxBound[k] = objects.size()? -std::numeric_limits<ELEMTYPE>::max(): 1;
+            for (auto& box: objectBoxes) {
+                root.minBound[k] = std::min(root.minBound[k], box.minBound[k]);
+                root.maxBound[k] = std::max(root.maxBound[k], box.maxBound[k]);
             }
-            // doesn't intersect with any surface, should never happen
-            assert(0);
+            maxExtent = std::max(maxExtent, root.maxBound[k] - root.minBound[k]);
         }
-        else {
-            // traverse all children nodes
-            for (INTTYPE i = 0; i < 8; ++i) 
-                if (subtree[i] -> search(ox, oy, oz, dx, dy, dz, func))
-                    return 1;
+        for (INTTYPE k = 0; k < 3; ++k) {
+            ELEMTYPE padding = std::max(maxExtent * EPSILON, ELEMTYPE(EPSILON));
+            root.minBound[k] -= padding;
+            root.maxBound[k] += padding;
         }
+        flatNodes.push_back(root);
 
-        return 0;
-    }
-
-};
+        std::vector<INTTYPE> objectIndices(objects.size());
+        for (INTTYPE i = 0; i < INTTYPE(objects.size()); ++i) objectIndices[i] = i;
+        buildRecursive(0, objectIndices, 0);
 
+        INTTYPE ropes[6] = { -1, -1, -1, -1, -1, -1 };
+        buildRopes(0, ropes);
+        built = 1;
+    }
 
-template < class DATATYPE, class ELEMTYPE, class INTTYPE, class REALTYPE, INTTYPE MAXOBJCOUNT >
-class Octree {
-    TreeNode<DATATYPE, ELEMTYPE, INTTYPE, REALTYPE, MAXOBJCOUNT>* root;
-    ELEMTYPE boundaryMinX, boundaryMaxX, 
-             boundaryMinY, boundaryMaxY, 
-             boundaryMinZ, boundaryMaxZ;
-public:
-    Octree(const ELEMTYPE minx, const ELEMTYPE miny, const ELEMTYPE minz,
-           const ELEMTYPE maxx, const ELEMTYPE maxy, const ELEMTYPE maxz): 
-        boundaryMinX(minx), boundaryMaxX(maxx), boundaryMinY(miny),
-        boundaryMaxY(maxy), boundaryMinZ(minz), boundaryMaxZ(maxz),
-        root(new TreeNode<DATATYPE, ELEMTYPE, INTTYPE, REALTYPE, MAXOBJCOUNT>
-                 (minx, miny, minz, maxx, maxy, maxz, 0)) {
+    template < class WRITER >
+    // writes the built tree, objects are written as numbers given by out
+    void save(WRITER& out) const {
+        assert(built);
+        out.write(_maxDepth);
+        out.write(_depth);
+        out.write(INTTYPE(objects.size()));
+        for (auto obj: objects) out.object(obj);
+        out.write(flatNodes);
+        out.write(flatObjectIds);
     }
 
-    ~Octree() { delete root; }
+    template < class READER >
+    // reads a tree written by save, objects are taken from in by their numbers.
+    // nodes are checked with in.check(), so a corrupted tree is never traversed
+    // out of its arrays
+    void load(READER& in) {
+        clear();
+        INTTYPE count;
+        in.read(_maxDepth);
+        in.read(_depth);
+        in.readCount(count);
+        for (INTTYPE i = 0; i < count && in.good(); ++i) {
+            const DATATYPE* obj;
+            in.object(obj);
+            insert(obj);
+        }
+        in.read(flatNodes);
+        in.read(flatObjectIds);
+
+        const INTTYPE n = flatNodes.size();
+        const INTTYPE objectCount = flatObjectIds.size();
+        in.check(n > 0);
+        for (INTTYPE i = 0; i < n && in.good(); ++i) {
+            const FlatNode& node = flatNodes[i];
+            // children after their parent, so descending always ends
+            if (node.isLeafNode())
+                in.check(node.objectOffset >= 0 && node.objectCount >= 0 &&
+                         node.objectCount <= objectCount - node.objectOffset);
+            else in.check(node.firstChild > i && node.firstChild <= n - 8);
+            for (INTTYPE s = 0; s < 6; ++s) 
+                in.check(node.ropes[s] >= -1 && node.ropes[s] < n && node.ropes[s] != i);
+        }
+        for (auto id: flatObjectIds) 
+            if (in.check(id >= 0 && id < INTTYPE(objects.size()))) flatObjects.push_back(objects[id]);
+        built = in.good();
+    }
 
-    INTTYPE size() const { return root -> size(); }
+    template < class LEAFFUNC >
+    // func(leaf, objects, count) for each leaf cell, leaves are numbered
+    // the same as in searchLeaves and occludedLeaves
+    void forEachLeaf(LEAFFUNC func) const {
+        assert(built);
+        for (INTTYPE i = 0; i < INTTYPE(flatNodes.size()); ++i)
+            if (!flatNodes[i].firstChild)
+                func(i, flatObjects.data() + flatNodes[i].objectOffset, flatNodes[i].objectCount);
+    }
 
-    void clear() {
-        delete root;
-        root = new TreeNode<DATATYPE, ELEMTYPE, INTTYPE, REALTYPE, MAXOBJCOUNT>
-                   (boundaryMinX, boundaryMinY, boundaryMinZ,
-                    boundaryMaxX, boundaryMaxY, boundaryMaxZ, 0);
+    template < class LEAFFUNC >
+    // (ox, oy, oz) starting point coordinate
+    // (dx, dy, dz) direction
+    // all objects of a leaf cell are tested by one call func(leaf, closest),
+    // which lowers closest to the closest intersection in the leaf and returns
+    // true if there is any. objects in more than one cell are met more than once,
+    // func should skip those tested already
+    bool searchLeaves(const ELEMTYPE ox, const ELEMTYPE oy, const ELEMTYPE oz,
+                      const ELEMTYPE dx, const ELEMTYPE dy, const ELEMTYPE dz,
+                      LEAFFUNC func) const {
+        assert(built);
+        const REALTYPE o[3] = { ox, oy, oz };
+        const REALTYPE d[3] = { dx, dy, dz };
+
+        REALTYPE closest = std::numeric_limits<REALTYPE>::max();
+        bool found = 0;
+        traverse(o, d, std::numeric_limits<REALTYPE>::max(), 
+                 [&](const FlatNode& node, const REALTYPE tExit) -> bool {
+            if (node.objectCount && func(INTTYPE(&node - &flatNodes[0]), closest)) found = 1;
+            // cells behind can't contain anything closer
+            return found && closest <= tExit;
+        });
+        return found;
     }
 
-    bool insert(const DATATYPE* obj) {
-        ELEMTYPE minx = obj -> lowerBoundX();
-        ELEMTYPE maxx = obj -> upperBoundX();
-        ELEMTYPE miny = obj -> lowerBoundY();
-        ELEMTYPE maxy = obj -> upperBoundY();
-        ELEMTYPE minz = obj -> lowerBoundZ();
-        ELEMTYPE maxz = obj -> upperBoundZ();
+    template < class LEAFFUNC >
+    // searchLeaves for count rays traced together, ray r starts from 
+    // (o[0][r], o[1][r], o[2][r]) going (d[0][r], d[1][r], d[2][r]), 
+    // invDirection is 1 / d. rays go through a cell together and follow its 
+    // ropes together while they leave through the same surface, each ray 
+    // visits the same cells in the same order as it would alone.
+    // func(leaf, rays) lowers closest[r] of each ray r in bit mask rays to 
+    // the closest intersection in the leaf, a ray stops once closest[r] is 
+    // within the cell. with closest[r] set to tMax, rays may also be
+    // searched for any intersection like in occludedLeaves
+    void searchPacket(const INTTYPE count, const ELEMTYPE* const o[3], const ELEMTYPE* const d[3], 
+                      const ELEMTYPE* const invDirection[3], const ELEMTYPE* closest, 
+                      LEAFFUNC func) const {
+        assert(built && count > 0 && count <= 32);
+        // distance at which ray r enters its current cell
+        REALTYPE t[32];
+        unsigned alive = 0;
+        for (INTTYPE r = 0; r < count; ++r) {
+            REALTYPE tEntry = 0, tExit = closest[r];
+            for (INTTYPE k = 0; k < 3; ++k) {
+                REALTYPE t0 = (flatNodes[0].minBound[k] - o[k][r]) * invDirection[k][r];
+                REALTYPE t1 = (flatNodes[0].maxBound[k] - o[k][r]) * invDirection[k][r];
+                if (t0 > t1) std::swap(t0, t1);
+                tEntry = std::max(tEntry, t0);
+                tExit = std::min(tExit, t1);
+            }
+            if (tEntry > tExit) continue;
+            t[r] = tEntry;
+            alive |= 1u << r;
+        }
 
-        assert(minx >= boundaryMinX && maxx < boundaryMaxX &&
-               miny >= boundaryMinY && maxy < boundaryMaxY &&
-               minz >= boundaryMinZ && maxz < boundaryMaxZ);
+        // rays of a group are in the same cell, each ray is in at most one group
+        struct Group { INTTYPE index; unsigned rays; };
+        Group stack[32];
+        INTTYPE stackSize = 0;
+        if (alive) stack[stackSize++] = Group{ 0, alive };
+        while (stackSize) {
+            Group group = stack[--stackSize];
+
+            // go down to the leaf containing the entry point of the first ray,
+            // rays entering other children are left for later
+            while (!flatNodes[group.index].isLeafNode()) {
+                INTTYPE child = -1;
+                unsigned same = 0;
+                for (INTTYPE r = 0; r < count; ++r) {
+                    if (!(group.rays >> r & 1)) continue;
+                    REALTYPE p[3], dr[3];
+                    for (INTTYPE k = 0; k < 3; ++k) {
+                        p[k] = o[k][r] + t[r] * d[k][r];
+                        dr[k] = d[k][r];
+                    }
+                    INTTYPE c = childContaining(group.index, p, dr);
+                    if (child < 0) child = c;
+                    if (c == child) same |= 1u << r;
+                }
+                if (same != group.rays) stack[stackSize++] = Group{ group.index, group.rays & ~same };
+                group = Group{ child, same };
+            }
 
-        return root -> insert(obj);
+            const FlatNode& node = flatNodes[group.index];
+            if (node.objectCount) func(group.index, group.rays);
+
+            // rays leaving through the same surface go on together
+            unsigned leaving[6] = { 0, 0, 0, 0, 0, 0 };
+            for (INTTYPE r = 0; r < count; ++r) {
+                if (!(group.rays >> r & 1)) continue;
+                Surface exitSurface = None;
+                REALTYPE tExit = std::numeric_limits<REALTYPE>::max();
+                for (INTTYPE k = 0; k < 3; ++k) {
+                    if (d[k][r] == 0) continue;
+                    REALTYPE tk = ((d[k][r] > 0? node.maxBound[k]: node.minBound[k]) - o[k][r]) * invDirection[k][r];
+                    if (tk < tExit) tExit = tk, exitSurface = Surface(2 * k + (d[k][r] < 0));
+                }
+                assert(exitSurface != None);
+                if (closest[r] <= tExit || node.ropes[exitSurface] < 0) continue;
+                t[r] = tExit;
+                leaving[exitSurface] |= 1u << r;
+            }
+            for (INTTYPE s = Front; s <= Down; ++s)
+                if (leaving[s]) stack[stackSize++] = Group{ node.ropes[s], leaving[s] };
+            assert(stackSize <= 32);
+        }
     }
 
-    template < class CALLBACKFUNC >
-    bool search(const ELEMTYPE ox, const ELEMTYPE oy, const ELEMTYPE oz,
-                const ELEMTYPE dx, const ELEMTYPE dy, const ELEMTYPE dz,
-                CALLBACKFUNC func) const {
-        return root -> search(ox, oy, oz, dx, dy, dz, func);
+    template < class LEAFFUNC >
+    // returns true as soon as func(leaf) returns true for a leaf cell
+    // the ray passes through within distance tMax
+    bool occludedLeaves(const ELEMTYPE ox, const ELEMTYPE oy, const ELEMTYPE oz,
+                        const ELEMTYPE dx, const ELEMTYPE dy, const ELEMTYPE dz,
+                        const ELEMTYPE tMax, LEAFFUNC func) const {
+        assert(built);
+        const REALTYPE o[3] = { ox, oy, oz };
+        const REALTYPE d[3] = { dx, dy, dz };
+
+        bool blocked = 0;
+        traverse(o, d, tMax, [&](const FlatNode& node, const REALTYPE) -> bool {
+            if (!node.objectCount) return 0;
+            return blocked = func(INTTYPE(&node - &flatNodes[0]));
+        });
+        return blocked;
     }
 };
 
@@ -8,7 +8,7 @@
  *  E-mail: hjm211324@gmail.com
  *  Date: May. 31, 2014
  *  Time: 10:47:03
- *  Description: obj file parser
+ *  Description: obj file parser, .objx of ours and standard .obj
  *****************************************************************************/
 #ifndef PARSER_H
 #define PARSER_H
@@ -17,23 +17,107 @@
 #include <map>
 #include <fstream>
 #include <sstream>
+#include <memory>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
 #include "scene.h"
 #include "camera.h"
-#include "triangle.h"
-#include "rectangle.h"
-#include "sphere.h"
+#include "objects.h"
 #include "lightsource.h"
 #include "material.h"
 #include "texture.h"
+#include "texturecache.h"
+#include "mappedfile.h"
 
 std::string removeSpaces(const std::string& str);
 
 class ObjParser {
+    // errors are kept as "file:line: message", only the first MAXERRORS of them
+    constexpr static COUNTTYPE MAXERRORS = 100;
+    // files are split into chunks of about CHUNKSIZE bytes parsed in parallel
+    constexpr static size_t CHUNKSIZE = 4 << 20;
+
+    static bool isSpace(const char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    static bool equals(const char* b, const char* e, const char* word) {
+        size_t length = strlen(word);
+        return size_t(e - b) == length && !memcmp(b, word, length);
+    }
+
+    // a line split in place into tokens separated by spaces
+    class Tokens {
+        const char* p;
+        const char* end;
+
+    public:
+        Tokens(const char* b, const char* e): p(b), end(e) { }
+
+        bool next(const char*& b, const char*& e) {
+            while (p < end && isSpace(*p)) ++p;
+            if (p == end) return 0;
+            b = p;
+            while (p < end && !isSpace(*p)) ++p;
+            e = p;
+            return 1;
+        }
+
+        // the rest of the line without surrounding spaces
+        std::string rest() {
+            const char* e = end;
+            while (p < e && isSpace(*p)) ++p;
+            while (p < e && isSpace(e[-1])) --e;
+            return std::string(p, e);
+        }
+    };
+
+    // numbers are parsed from a copy ended by 0, which strtod needs
+    static bool parseReal(const char* b, const char* e, ELEMTYPE& value) {
+        char buffer[64];
+        size_t length = e - b;
+        if (!length || length >= sizeof(buffer)) return 0;
+        memcpy(buffer, b, length);
+        buffer[length] = 0;
+        char* stop;
+        value = strtod(buffer, &stop);
+        return stop == buffer + length;
+    }
+
+    // vertex index of a face corner, the first of v/vt/vn
+    static bool parseIndex(const char* b, const char* e, long& value) {
+        char buffer[32];
+        size_t length = std::find(b, e, '/') - b;
+        if (!length || length >= sizeof(buffer)) return 0;
+        memcpy(buffer, b, length);
+        buffer[length] = 0;
+        char* stop;
+        value = strtol(buffer, &stop, 10);
+        return stop == buffer + length;
+    }
+
     class MtlParser {
+        ObjParser& parser;
         std::map<std::string, std::pair<Material*, Texture*> > mtl;
         std::pair<Material*, Texture*> _activeMtl;
-        
-        void parse(const std::string& line) {
+        // material of standard files which statements are applied to
+        Material* current;
+
+        Texture* newTexture(const std::string& textureFilename, const std::string& filename, const size_t line) {
+            std::shared_ptr<const Picture> picture = 
+                TextureCache::instance().load(locate(textureFilename, filename));
+            if (!picture) {
+                parser.error(filename, line, "can't open texture " + textureFilename);
+                return nullptr;
+            }
+            return parser.scene.arena().create<Texture>(picture);
+        }
+
+        // newmtl name r g b ac dr sr s r rlw rrw tp [texture [scale]]
+        // maxdepth name n
+        void parse(const std::string& line, const std::string& filename, const size_t lineNumber) {
             // delete space characters
             std::string str = removeSpaces(line);
             if (!str.length()) return;
@@ -47,182 +131,434 @@ class ObjParser {
                 bool tp;
                 
                 //parameters of material
-                bool res = strs >> mtlname >> mtlname >> colorR >> colorG >> colorB
-                                >> ac >> dr >> sr >> s >> r >> rlw >> rrw >> tp;
-                assert(res);
-                assert(mtl.find(mtlname) == mtl.end());
+                bool res = bool(strs >> mtlname >> mtlname >> colorR >> colorG >> colorB
+                                     >> ac >> dr >> sr >> s >> r >> rlw >> rrw >> tp);
+                if (!res) return parser.error(filename, lineNumber, "bad material");
+                if (mtl.find(mtlname) != mtl.end()) 
+                    return parser.error(filename, lineNumber, "material " + mtlname + " defined again");
                 
-                Material* material = new Material(Color(colorR, colorG, colorB), 
-                                                  ac, dr, sr, s, r, rlw, rrw, tp);
+                Material* material = parser.scene.arena().create<Material>(Color(colorR, colorG, colorB), 
+                                                                           ac, dr, sr, s, r, rlw, rrw, tp);
 
                 Texture* texture = nullptr;
                 std::string textureFilename;
-                //new texture, optional
+                //new texture, optional, its picture is shared with others of the same file
                 if (strs >> textureFilename) {
-                    texture = new Texture(0, 0);
-                    loadTextureFromPic(texture, textureFilename);
+                    texture = newTexture(textureFilename, filename, lineNumber);
+                    if (!texture) return;
                     ELEMTYPE textureScale;
-                    if (strs >> textureScale) 
+                    if (strs >> textureScale) {
                         if (textureScale > 0) 
                             texture -> setScale(textureScale);
                         else if (textureScale == 0)
                             texture -> setFillMode(Texture::STRETCH);
-                        else assert(0);
+                        else return parser.error(filename, lineNumber, "negative texture scale");
+                    }
                 }
             
                 mtl[mtlname] = std::make_pair(material, texture);
                 return;
             }
-            assert(0);
+
+            // maxdepth name n, secondary rays spawned on material name go n bounces deep at most
+            if (str.length() >= 8 && str.substr(0, 8) == "maxdepth") {
+                std::istringstream strs(str);
+                std::string keyword, mtlname;
+                COUNTTYPE depth;
+                if (!(strs >> keyword >> mtlname >> depth) || depth < 0) 
+                    return parser.error(filename, lineNumber, "bad max depth");
+                auto ite = mtl.find(mtlname);
+                if (ite == mtl.end()) return parser.error(filename, lineNumber, "material " + mtlname + " not defined");
+                ite -> second.first -> setMaxDepth(depth);
+                return;
+            }
+            parser.error(filename, lineNumber, "unknown statement");
         }
 
-        void loadTextureFromPic(Texture* texture, const std::string& filename) {
-            texture -> clear();
-            cv::Mat_<cv::Vec3b> textureImage = cv::imread(filename.c_str());
+        // standard .mtl statements, those with no counterpart here are ignored
+        void parseStandard(const std::string& line, const std::string& filename, const size_t lineNumber) {
+            Tokens tokens(line.data(), line.data() + line.length());
+            const char *b, *e;
+            if (!tokens.next(b, e) || *b == '#') return;
+
+            if (equals(b, e, "newmtl")) {
+                std::string mtlname = tokens.rest();
+                if (mtlname.empty()) return parser.error(filename, lineNumber, "material without name");
+                if (mtl.find(mtlname) != mtl.end()) 
+                    return parser.error(filename, lineNumber, "material " + mtlname + " defined again");
+                current = defaultMaterial(parser.scene.arena());
+                mtl[mtlname] = std::make_pair(current, nullptr);
+                return;
+            }
 
-            //if (!textureImage.data) return;   
-            assert(textureImage.data);
+            // maxdepth isn't standard, it limits depth of secondary rays spawned on the material
+            bool known = equals(b, e, "Kd") || equals(b, e, "Ns") || equals(b, e, "Ni") || 
+                         equals(b, e, "d") || equals(b, e, "Tr") || equals(b, e, "map_Kd") ||
+                         equals(b, e, "maxdepth");
+            if (!known) return;
+            if (!current) return parser.error(filename, lineNumber, "statement before newmtl");
 
-            texture -> setLength(textureImage.cols);
-            texture -> setWidth(textureImage.rows);
+            if (equals(b, e, "map_Kd")) {
+                // options before the file name are ignored
+                std::string textureFilename;
+                while (tokens.next(b, e)) textureFilename.assign(b, e);
+                Texture* texture = newTexture(textureFilename, filename, lineNumber);
+                if (!texture) return;
+                for (auto& ite: mtl) 
+                    if (ite.second.first == current) ite.second.second = texture;
+                return;
+            }
 
-            for (auto ite: textureImage) 
-                texture -> setPixel(Color(ite[2], ite[1], ite[0]));
+            ELEMTYPE values[3];
+            COUNTTYPE count = equals(b, e, "Kd")? 3: 1;
+            const char *vb, *ve;
+            for (COUNTTYPE k = 0; k < count; ++k) 
+                if (!tokens.next(vb, ve) || !parseReal(vb, ve, values[k]))
+                    return parser.error(filename, lineNumber, "bad number");
+            
+            if (equals(b, e, "Kd")) current -> setColor(Color(values[0] * 255, values[1] * 255, values[2] * 255));
+            else if (equals(b, e, "Ns")) current -> setShininess(values[0]);
+            else if (equals(b, e, "Ni")) current -> setRefractiveIndex(values[0]);
+            else if (equals(b, e, "maxdepth")) {
+                if (values[0] < 0) return parser.error(filename, lineNumber, "bad max depth");
+                current -> setMaxDepth(COUNTTYPE(values[0]));
+            }
+            else if (equals(b, e, "d")) current -> setTransparent(values[0] < 1);
+            else current -> setTransparent(values[0] > 0);
         }
 
     public:
-        MtlParser(): _activeMtl(std::make_pair(nullptr, nullptr)) { }
+        MtlParser(ObjParser& p): parser(p), _activeMtl(std::make_pair(nullptr, nullptr)), current(nullptr) { }
 
-        std::pair<Material*, Texture*> activeMtl() const {
-            assert(_activeMtl.first);
-            return _activeMtl;
+        // gray, diffuse with a little highlight
+        static Material* defaultMaterial(Arena& arena) {
+            return arena.create<Material>(Color(204, 204, 204), 10, 1, 15, 8.5);
         }
 
-        void useMtl(const std::string& mtlname) {
+        // material and texture faces are made of, nullptr if none is used yet
+        std::pair<Material*, Texture*> activeMtl() const { return _activeMtl; }
+
+        bool useMtl(const std::string& mtlname) {
             auto ite = mtl.find(mtlname);
-            assert(ite != mtl.end());
+            if (ite == mtl.end()) return 0;
             _activeMtl = ite -> second;
+            return 1;
         }
 
-        void loadMtlFile(const std::string& filename) {
+        // .mtl files are standard, others (.mtlx) ours
+        bool loadMtlFile(const std::string& filename) {
             std::ifstream fin(filename.c_str());
-            assert(fin.is_open());
+            if (!fin.is_open()) return 0;
 
+            bool standard = hasExtension(filename, ".mtl");
+            current = nullptr;
             std::string line;
-            while (getline(fin, line)) parse(line);
+            for (size_t lineNumber = 1; getline(fin, line); ++lineNumber) 
+                if (standard) parseStandard(line, filename, lineNumber);
+                else parse(line, filename, lineNumber);
+            return 1;
         }
+    };
 
+    // a corner of a face, its vertex is numbered in the whole file,
+    // or counted from the end of vertices of its chunk if relative
+    // index of a vertex of the file, or of the chunk if relative.
+    // relative indices may be negative, for vertices of chunks before
+    struct Corner {
+        long index;
+        bool relative;
     };
 
-    std::vector<Point> vertices;
-    std::vector<Object*> objects;
-    std::vector<LightSource*> lights;
-    std::ifstream fin;
+    struct Face {
+        size_t first; // first corner
+        COUNTTYPE count;
+        COUNTTYPE line;
+        ELEMTYPE radius; // spheres are given by their center and radius
+        bool sphere;
+    };
+
+    // mtllib and usemtl, applied before face of index face
+    struct Directive {
+        size_t face;
+        COUNTTYPE line;
+        bool library;
+        std::string name;
+    };
+
+    // what's parsed from a chunk of lines, independent of other chunks.
+    // lines are numbered in the chunk
+    struct Chunk {
+        const char* begin;
+        const char* end;
+        std::vector<Point> vertices;
+        std::vector<Corner> corners;
+        std::vector<Face> faces;
+        std::vector<Directive> directives;
+        std::vector< std::pair<COUNTTYPE, std::string> > errors;
+        COUNTTYPE lines;
+        size_t vertexOffset; // vertices of chunks before
+
+        void error(const COUNTTYPE line, const std::string& message) {
+            if (errors.size() < size_t(MAXERRORS)) errors.push_back(std::make_pair(line, message));
+        }
+    };
+
+    // shared by meshes of all faces
+    std::shared_ptr< std::vector<Point> > vertices;
+    // faces go to the last mesh, a new one is made after other objects
+    // so objects are in the scene in order of the file
+    TriangleMesh* mesh;
+    std::vector<uint32_t> polygon;
+    Material* _defaultMaterial;
+    std::vector<std::string> _errors;
+    COUNTTYPE _errorCount;
+    COUNTTYPE _skipped;
+    bool standard;
     Scene& scene;
     MtlParser mtlParser;
 
-public:
-    ObjParser(const std::string& filename, Scene& s): scene(s) {
-        fin.open(filename.c_str());
-        assert(fin.is_open());
+    static bool hasExtension(const std::string& filename, const std::string& extension) {
+        return filename.length() >= extension.length() &&
+               filename.compare(filename.length() - extension.length(), extension.length(), extension) == 0;
+    }
 
-        std::string line;
-        while (getline(fin, line)) parse(line);
+    // filename as it is if it can be opened, 
+    // or else relative to the directory of the file referring to it
+    static std::string locate(const std::string& filename, const std::string& referrer) {
+        if (std::ifstream(filename.c_str()).is_open() || filename.empty() || filename[0] == '/') return filename;
+        size_t slash = referrer.rfind('/');
+        if (slash == std::string::npos) return filename;
+        return referrer.substr(0, slash + 1) + filename;
     }
 
-    ~ObjParser() { 
-        fin.close(); 
-        for (auto ite: objects) delete ite;
-        for (auto ite: lights) delete ite;
+    void error(const std::string& filename, const size_t line, const std::string& message) {
+        if (_errorCount++ < MAXERRORS) 
+            _errors.push_back(filename + ":" + std::to_string(line) + ": " + message);
     }
 
-    void parse(const std::string& line) {
-        // delete space characters
-        std::string str = removeSpaces(line);
-        if (!str.length()) return;
-        if (str[0] == '#') return; // comments
+    // statements of standard files other than v, f, mtllib and usemtl are ignored,
+    // these are ignored in ours too
+    static bool ignored(const char* b, const char* e) {
+        return equals(b, e, "vt") || equals(b, e, "vn") || equals(b, e, "vp") ||
+               equals(b, e, "g") || equals(b, e, "o") || equals(b, e, "s") || 
+               equals(b, e, "l") || equals(b, e, "p");
+    }
 
-        if (str[0] == 'v') {  // vertex
-            std::istringstream strs(str);
-            strs.get();
+    void parseFace(Tokens& tokens, Chunk& chunk, const COUNTTYPE line) const {
+        Face face;
+        face.first = chunk.corners.size();
+        face.line = line;
+        face.radius = 0;
+        face.sphere = 0;
+
+        COUNTTYPE count = 0;
+        const char *b, *e, *radius = nullptr, *radiusEnd = nullptr;
+        bool bad = 0, badSecond = 0;
+        while (tokens.next(b, e)) {
+            ++count;
+            long index = 0;
+            bool res = parseIndex(b, e, index) && (index || !standard);
+            // the second of ours may be the radius of a sphere, known at the end
+            if (count == 2 && !standard) radius = b, radiusEnd = e, badSecond = !res;
+            else if (!res) bad = 1;
+            Corner corner;
+            corner.relative = index < 0;
+            // negative indices count back from the last vertex read
+            if (index < 0) corner.index = long(chunk.vertices.size()) + index;
+            else corner.index = standard? index - 1: index;
+            chunk.corners.push_back(corner);
+        }
 
-            ELEMTYPE x, y, z;
-            bool res = strs >> x >> y >> z;
+        // f v r of ours is a sphere
+        if (radius && count == 2) {
+            chunk.corners.pop_back();
+            face.sphere = 1;
+            if (!parseReal(radius, radiusEnd, face.radius) || face.radius <= 0) bad = 1;
+        } else if (badSecond) bad = 1;
+        face.count = chunk.corners.size() - face.first;
+
+        if (bad) return chunk.corners.resize(face.first), chunk.error(line, "bad face");
+        if (standard? count < 3: count < 1) return chunk.corners.resize(face.first), chunk.error(line, "too few vertices");
+        chunk.faces.push_back(face);
+    }
 
-            assert(res);
+    // tokenizes lines of the chunk in place, touching nothing but the chunk
+    void parseChunk(Chunk& chunk) const {
+        COUNTTYPE line = 0;
+        for (const char* p = chunk.begin; p < chunk.end; ) {
+            const char* eol = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+            if (!eol) eol = chunk.end;
+            ++line;
+            Tokens tokens(p, eol);
+            p = eol + (eol < chunk.end);
+
+            const char *b, *e;
+            if (!tokens.next(b, e) || *b == '#') continue; // comments
+
+            if (equals(b, e, "v")) { // vertex
+                Point v;
+                bool res = 1;
+                for (COUNTTYPE k = 0; k < 3 && res; ++k) res = tokens.next(b, e) && parseReal(b, e, v[k]);
+                if (!res) chunk.error(line, "bad vertex");
+                // kept anyway, or vertices after it would be numbered wrong
+                chunk.vertices.push_back(v);
+            } else if (equals(b, e, "f")) { // face
+                parseFace(tokens, chunk, line);
+            } else if (equals(b, e, "mtllib") || equals(b, e, "usemtl")) { // material and texture lib
+                Directive directive;
+                directive.face = chunk.faces.size();
+                directive.line = line;
+                directive.library = equals(b, e, "mtllib");
+                directive.name = tokens.rest();
+                chunk.directives.push_back(directive);
+            } else if (!standard && !ignored(b, e)) {
+                chunk.error(line, "unknown statement");
+            }
+        }
+        chunk.lines = line;
+    }
 
-            vertices.push_back(Point(x, y, z));
-            return;
+    void apply(const Directive& directive, const std::string& filename, const size_t line) {
+        if (directive.library) {
+            if (!mtlParser.loadMtlFile(locate(directive.name, filename)))
+                error(filename, line, "can't open material library " + directive.name);
+        } else if (!mtlParser.useMtl(directive.name)) {
+            error(filename, line, "unknown material " + directive.name);
         }
+    }
 
-        if (str[0] == 'f') { //face
-            std::istringstream strs0(str), strs1(str);
-            strs0.get();
-            strs1.get();
+    void insert(Object* obj) {
+        scene.insert(obj);
+        mesh = nullptr;
+    }
 
-            COUNTTYPE v0, v1, v2, v3;
-            ELEMTYPE r;
-            
-            COUNTTYPE numParas = 0;
-            std::string tmp;
-            while (strs0 >> tmp) ++numParas;
-            
-            switch (numParas) {
-                case 1: {
-                    strs1 >> v0;
-                    LightSource* light = new LightSource(vertices[v0], 
-                                             mtlParser.activeMtl().first -> color());
-                    lights.push_back(light);
-                    scene.insert(light);
-                    break;
-                }
-                case 2: {
-                    strs1 >> v0 >> r;
-                    Sphere* obj = new Sphere(vertices[v0], r, 
-                                             mtlParser.activeMtl().first, 
-                                             mtlParser.activeMtl().second);
-                    objects.push_back(obj);
-                    scene.insert(obj);
-                    break;
-                }
-                case 3: {
-                    strs1 >> v0 >> v1 >> v2;
-                    Triangle* obj = new Triangle(vertices[v0], vertices[v1], vertices[v2], 
-                                                 mtlParser.activeMtl().first, 
-                                                 mtlParser.activeMtl().second);
-                    objects.push_back(obj);
-                    scene.insert(obj);
-                    break;
-                }
-                case 4: {
-                    strs1 >> v0 >> v1 >> v2 >> v3;
-                    Rectangle* obj = new Rectangle(vertices[v0], vertices[v1], 
-                                                   vertices[v2], vertices[v3],
-                                                   mtlParser.activeMtl().first,
-                                                   mtlParser.activeMtl().second);
-                    objects.push_back(obj);
-                    scene.insert(obj);
-                    break;
-                }
-                default:
-                    assert(0);
-            }
+    // a triangle or a quad of material mtl to the last mesh
+    void insertFace(const uint32_t* indices, const COUNTTYPE count, const std::pair<Material*, Texture*>& mtl) {
+        if (!mesh) {
+            TriangleMesh* newMesh = scene.arena().create<TriangleMesh>(vertices);
+            insert(newMesh);
+            mesh = newMesh;
+        }
+        TriangleMesh::Face face;
+        std::copy(indices, indices + count, face.vertices);
+        if (count == 3) face.vertices[3] = TriangleMesh::NOVERTEX;
+        face.material = mesh -> addMaterial(mtl.first, mtl.second);
+        mesh -> addFace(face);
+    }
+
+    void insertFace(const Chunk& chunk, const Face& face, const std::string& filename, const size_t line) {
+        // indices of vertices, checked
+        polygon.resize(face.count);
+        for (COUNTTYPE k = 0; k < face.count; ++k) {
+            const Corner& corner = chunk.corners[face.first + k];
+            long index = corner.relative? long(chunk.vertexOffset) + corner.index: corner.index;
+            if (index < 0 || index >= long(vertices -> size())) 
+                return error(filename, line, "vertex index out of range");
+            polygon[k] = index;
+        }
+        auto p = [&](const COUNTTYPE k) -> const Point& { return (*vertices)[polygon[k]]; };
+
+        std::pair<Material*, Texture*> mtl = mtlParser.activeMtl();
+        if (!mtl.first) {
+            if (!standard) return error(filename, line, "no material in use");
+            if (!_defaultMaterial) _defaultMaterial = MtlParser::defaultMaterial(scene.arena());
+            mtl.first = _defaultMaterial;
+        }
+
+        if (face.sphere) {
+            insert(scene.arena().create<Sphere>(p(0), face.radius, mtl.first, mtl.second));
+            return;
+        }
+        if (face.count == 1 && !standard) {
+            scene.insert(scene.arena().create<LightSource>(p(0), mtl.first -> color()));
             return;
         }
 
-        // material and texture lib
-        if (str.length() >= 6 && str.substr(0, 6) == "mtllib") {
-            mtlParser.loadMtlFile(removeSpaces(str.substr(6)));
+        if (face.count == 4 && TriangleMesh::isFlatQuad(p(0), p(1), p(2), p(3))) {
+            insertFace(polygon.data(), 4, mtl);
             return;
         }
-        
-        if (str.length() >= 6 && str.substr(0, 6) == "usemtl") {
-            mtlParser.useMtl(removeSpaces(str.substr(6)));
+        // polygons are split into triangles around the first vertex,
+        // triangles of no area are skipped
+        for (COUNTTYPE k = 2; k < face.count; ++k) {
+            if (crossProduct(p(k - 1) - p(0), p(k) - p(0)).norm() == 0) {
+                ++_skipped;
+                continue;
+            }
+            uint32_t triangle[3] = { polygon[0], polygon[k - 1], polygon[k] };
+            insertFace(triangle, 3, mtl);
+        }
+    }
+
+public:
+    // .obj files are standard Wavefront, vertices numbered from 1, faces of any
+    // number of vertices. others (.objx) are ours, vertices numbered from 0, 
+    // faces of 1 vertex are lights, of a vertex and a radius spheres.
+    // all made are in the arena of s, they outlive me.
+    // errors() tells what's wrong if the file can't be parsed
+    ObjParser(const std::string& filename, Scene& s): 
+        vertices(std::make_shared< std::vector<Point> >()), mesh(nullptr), _defaultMaterial(nullptr),
+        _errorCount(0), _skipped(0), standard(hasExtension(filename, ".obj")), scene(s), mtlParser(*this) {
+        MappedFile file(filename);
+        if (!file.good()) {
+            error(filename, 0, "can't open");
             return;
         }
-    
-        assert(0);
+
+        // chunks end at line ends
+        size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+        size_t chunkCount = std::max<size_t>(1, std::min(threads, file.size() / CHUNKSIZE));
+        std::vector<Chunk> chunks(chunkCount);
+        const char* p = file.begin();
+        for (size_t k = 0; k < chunkCount; ++k) {
+            const char* end = std::max(p, file.begin() + file.size() / chunkCount * (k + 1));
+            if (k + 1 == chunkCount) end = file.end();
+            end = std::find(end, file.end(), '\n');
+            if (end < file.end()) ++end;
+            chunks[k].begin = p;
+            chunks[k].end = p = end;
+        }
+
+        std::vector<std::thread> workers;
+        for (size_t k = 1; k < chunkCount; ++k) 
+            workers.push_back(std::thread(&ObjParser::parseChunk, this, std::ref(chunks[k])));
+        parseChunk(chunks[0]);
+        for (auto& worker: workers) worker.join();
+
+        // vertices of all chunks first, faces may refer to those after them
+        size_t vertexCount = 0;
+        for (auto& chunk: chunks) chunk.vertexOffset = vertexCount, vertexCount += chunk.vertices.size();
+        // faces refer to them by 32-bit indices
+        if (vertexCount >= size_t(TriangleMesh::NOVERTEX)) {
+            error(filename, 0, "too many vertices");
+            return;
+        }
+        vertices -> reserve(vertexCount);
+        for (auto& chunk: chunks) vertices -> insert(vertices -> end(), chunk.vertices.begin(), chunk.vertices.end());
+
+        // then objects in order of the file
+        size_t lineOffset = 0;
+        for (auto& chunk: chunks) {
+            for (auto& ite: chunk.errors) error(filename, lineOffset + ite.first, ite.second);
+            size_t d = 0;
+            for (size_t i = 0; i <= chunk.faces.size(); ++i) {
+                for (; d < chunk.directives.size() && chunk.directives[d].face == i; ++d) 
+                    apply(chunk.directives[d], filename, lineOffset + chunk.directives[d].line);
+                if (i < chunk.faces.size()) 
+                    insertFace(chunk, chunk.faces[i], filename, lineOffset + chunk.faces[i].line);
+            }
+            lineOffset += chunk.lines;
+        }
     }
+
+    ObjParser(const ObjParser&) = delete;
+    ObjParser& operator=(const ObjParser&) = delete;
+
+    // "file:line: message" of the first errors found, the scene is incomplete if any
+    const std::vector<std::string>& errors() const { return _errors; }
+    COUNTTYPE errorCount() const { return _errorCount; }
+    // faces of no area which aren't in the scene
+    COUNTTYPE skipped() const { return _skipped; }
 };
 
 
@@ -240,6 +576,7 @@ class CmrParser {
     ELEMTYPE retinaRatio;
     COUNTTYPE AARatio;
     Camera* camera;
+    std::map<std::string, std::string> options;
 public:
     CmrParser(const std::string& filename) {
         std::ifstream fin(filename.c_str());
@@ -250,25 +587,31 @@ public:
             else strs << removeSpaces(line) << ' ';
         fin.close();
 
-        bool res = strs >> viewPoint[0] >> viewPoint[1] >> viewPoint[2]
-                        >> angleTheta >> anglePhi 
-                        >> refractiveIndex
-                        >> distanceR 
-                        >> resolutionLength >> resolutionWidth 
-                        >> retinaRatio 
-                        >> focalLength >> apertureSize >> numRays 
-                        >> AARatio;
+        bool res = bool(strs >> viewPoint[0] >> viewPoint[1] >> viewPoint[2]
+                             >> angleTheta >> anglePhi 
+                             >> refractiveIndex
+                             >> distanceR 
+                             >> resolutionLength >> resolutionWidth 
+                             >> retinaRatio 
+                             >> focalLength >> apertureSize >> numRays 
+                             >> AARatio);
         assert(res);
+
+        // optional settings, each is a "name value" pair
+        std::string name, value;
+        while (strs >> name >> value) options[name] = value;
+
         camera = new Camera(viewPoint, distanceR, 
-                            resolutionLength * AARatio,
-                            resolutionWidth * AARatio,
-                            retinaRatio / AARatio,
+                            resolutionLength,
+                            resolutionWidth,
+                            retinaRatio,
                             refractiveIndex);
         camera -> setAngleTheta(angleTheta * PI / 180);
         camera -> setAnglePhi(anglePhi * PI / 180);
         camera -> setFocalLength(focalLength);
         camera -> setApertureSize(apertureSize);
         camera -> setNumberRays(numRays);
+        camera -> setAARatio(AARatio);
     }
 
     Camera* getCamera() const {
@@ -277,6 +620,13 @@ public:
 
     COUNTTYPE aaRatio() const { return AARatio; }
 
+    // returns defaultValue if the option isn't set
+    std::string option(const std::string& name, const std::string& defaultValue = "") const {
+        auto ite = options.find(name);
+        return ite == options.end()? defaultValue: ite -> second;
+    }
+    void setOption(const std::string& name, const std::string& value) { options[name] = value; }
+
     ~CmrParser() { delete camera; }
 };
 
@@ -0,0 +1,607 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: primitives.h
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 17:03:51
+ *  Description: Objects of leaves of acceleration structures, copied into
+ *               blocks of triangles and spheres. Each block stores a few
+ *               primitives structure of arrays, so they are intersected
+ *               with a ray together. A rectangle or a quad of a mesh
+ *               is two triangles.
+ *               Materials of the objects are copied into a table.
+ *****************************************************************************/
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include "common.h"
+#include "simd.h"
+#include "ray.h"
+#include "material.h"
+#include "objects.h"
+
+using namespace RayTracing;
+
+class PrimitiveStreams {
+    typedef Lanes<ELEMTYPE> Lane;
+    constexpr static COUNTTYPE WIDTH = Lane::WIDTH;
+
+    // constant data of triangle intersection, A is the first vertex,
+    // AB = A - B, CA = C - A as in Triangle::isIntersected, N = AB x CA
+    struct TriangleLanes {
+        ELEMTYPE a[3][WIDTH];
+        ELEMTYPE ab[3][WIDTH];
+        ELEMTYPE ca[3][WIDTH];
+        ELEMTYPE n[3][WIDTH];
+    };
+
+    // unused lanes are filled with primitives that are never intersected,
+    // null objects and the id of the first lane.
+    // both triangles of a rectangle refer to the rectangle, triangles of a
+    // mesh to the mesh, parts tells them apart as Hit::primitive.
+    // bit k of opaque is set if the object of lane k isn't transparent
+    struct TriangleBlock {
+        TriangleLanes triangles;
+        const Object* objects[WIDTH];
+        COUNTTYPE parts[WIDTH];
+        COUNTTYPE materials[WIDTH];
+        COUNTTYPE ids[WIDTH];
+        int opaque;
+    };
+
+    struct SphereBlock {
+        ELEMTYPE center[3][WIDTH];
+        ELEMTYPE radiusSqr[WIDTH];
+        const Object* objects[WIDTH];
+        COUNTTYPE materials[WIDTH];
+        COUNTTYPE ids[WIDTH];
+        int opaque;
+    };
+
+    // an object may be in many leaves, a block is skipped if
+    // all its primitives have been tested by the same ray.
+    // the two triangles of a rectangle or a quad have their own ids.
+    // rays traced together share an id, each of them has a bit of the stamp
+    struct Stamp {
+        unsigned rayId;
+        unsigned rays;
+    };
+
+    struct Mailbox {
+        unsigned long long generation;
+        std::vector<Stamp> stamps;
+        unsigned lastRayId;
+        // primitives tested, and those skipped as tested already, not yet added to the streams
+        unsigned long long tests, avoided;
+        Mailbox(): generation(0), lastRayId(0), tests(0), avoided(0) { }
+    };
+
+public:
+    // a ray copied into all lanes, made once for all leaves it's tested in
+    struct RayLanes {
+        const Ray* ray;
+        Mailbox* box;
+        unsigned rayId;
+        unsigned rayBit;
+        Lane origin[3];
+        Lane direction[3];
+        RayLanes(): ray(nullptr), box(nullptr), rayId(0), rayBit(0) { }
+        RayLanes(const Ray& r, const PrimitiveStreams& streams) { set(r, streams); }
+        void set(const Ray& r, const PrimitiveStreams& streams) {
+            box = &streams.mailbox();
+            set(r, newRayId(*box), 0);
+        }
+        // ray traced together with first, as the slot-th of them
+        void set(const Ray& r, const RayLanes& first, const COUNTTYPE slot) {
+            box = first.box;
+            set(r, first.rayId, slot);
+        }
+
+    private:
+        void set(const Ray& r, const unsigned id, const COUNTTYPE slot) {
+            assert(slot >= 0 && slot < 32);
+            ray = &r;
+            rayId = id;
+            rayBit = 1u << slot;
+            for (COUNTTYPE k = 0; k < 3; ++k) {
+                origin[k] = Lane::broadcast(r.origin()[k]);
+                direction[k] = Lane::broadcast(r.direction()[k]);
+            }
+        }
+    };
+
+    // blocks of each stream holding the objects of a leaf
+    struct Range {
+        COUNTTYPE triangleBlock, triangleBlocks;
+        COUNTTYPE sphereBlock, sphereBlocks;
+        Range(): triangleBlock(0), triangleBlocks(0), sphereBlock(0), sphereBlocks(0) { }
+    };
+
+private:
+    std::vector<TriangleBlock> triangles;
+    std::vector<SphereBlock> spheres;
+    // first id of each primitive, a primitive of two triangles has two
+    std::unordered_map<const Primitive*, COUNTTYPE> primitiveIds;
+    // kept apart from primitiveIds, which is left empty by load
+    COUNTTYPE primitiveCount;
+    // materials of all objects in the streams, by the index in Hit::material
+    std::vector<Material> materials;
+    std::unordered_map<const Material*, COUNTTYPE> materialIds;
+    // identifies the content of any streams, so mailboxes of old content are never reused
+    unsigned long long generation;
+    // in a function, so the header can be included by more than one file
+    static std::atomic<unsigned long long>& generations() {
+        static std::atomic<unsigned long long> count(0);
+        return count;
+    }
+    // statistics of all rays traced
+    mutable std::atomic<unsigned long long> _objectTests;
+    mutable std::atomic<unsigned long long> _duplicateTestsAvoided;
+
+    // mailbox of current thread, for the current streams
+    Mailbox& mailbox() const {
+        thread_local Mailbox box;
+        if (box.generation != generation) {
+            box.generation = generation;
+            box.stamps.assign(primitiveCount, Stamp{ 0, 0 });
+            box.lastRayId = 0;
+            box.tests = box.avoided = 0;
+        }
+        return box;
+    }
+
+    // all stamps are cleared when ids run out, 
+    // rays still being traced may test some primitives again
+    static unsigned newRayId(Mailbox& box) {
+        if (++box.lastRayId == 0) {
+            box.stamps.assign(box.stamps.size(), Stamp{ 0, 0 });
+            box.lastRayId = 1;
+        }
+        return box.lastRayId;
+    }
+
+    COUNTTYPE id(const Primitive* primitive, const COUNTTYPE triangles) {
+        auto ite = primitiveIds.find(primitive);
+        if (ite != primitiveIds.end()) return ite -> second;
+        COUNTTYPE newId = primitiveCount;
+        primitiveCount += std::max(triangles, COUNTTYPE(1));
+        primitiveIds[primitive] = newId;
+        generation = ++generations();
+        return newId;
+    }
+
+    COUNTTYPE materialId(const Material* mat) {
+        auto ite = materialIds.find(mat);
+        if (ite != materialIds.end()) return ite -> second;
+        COUNTTYPE newId = materials.size();
+        materialIds[mat] = newId;
+        materials.push_back(*mat);
+        return newId;
+    }
+
+    template < class BLOCK >
+    // marks primitives of block as tested by the ray, returns false if all of them already were
+    static bool untested(const BLOCK& block, const RayLanes& ray) {
+        bool fresh = 0;
+        for (COUNTTYPE k = 0; k < WIDTH; ++k) {
+            Stamp& stamp = ray.box -> stamps[block.ids[k]];
+            if (stamp.rayId != ray.rayId) stamp = Stamp{ ray.rayId, 0 };
+            if (!(stamp.rays & ray.rayBit)) fresh = 1;
+            stamp.rays |= ray.rayBit;
+        }
+        return fresh;
+    }
+
+    template < class BLOCK >
+    // lanes of block holding primitives, the last block of a leaf is padded
+    static COUNTTYPE used(const BLOCK& block) {
+        COUNTTYPE count = 0;
+        for (COUNTTYPE k = 0; k < WIDTH; ++k) count += block.objects[k] != nullptr;
+        return count;
+    }
+
+    static void setTriangle(TriangleLanes& lanes, const COUNTTYPE k, 
+                            const Point& a, const Vector& ab, const Vector& ca) {
+        Vector n = crossProduct(ab, ca);
+        for (COUNTTYPE i = 0; i < 3; ++i) {
+            lanes.a[i][k] = a[i];
+            lanes.ab[i][k] = ab[i];
+            lanes.ca[i][k] = ca[i];
+            lanes.n[i][k] = n[i];
+        }
+    }
+
+    // lane k is never intersected, N is zero
+    static void clearTriangle(TriangleLanes& lanes, const COUNTTYPE k) {
+        for (COUNTTYPE i = 0; i < 3; ++i)
+            lanes.a[i][k] = lanes.ab[i][k] = lanes.ca[i][k] = lanes.n[i][k] = 0;
+    }
+
+    // Triangle::isIntersected by Cramer's rule, with the triple products
+    // rearranged so that only d x AO depends on both the ray and the triangle:
+    // deterA = d * N, beta = (d x AO) * CA / deterA, 
+    // gamma = (d x AO) * AB / deterA, t = AO * N / deterA
+    static Lane::Mask intersect(const TriangleBlock& block, const RayLanes& ray, Lane& t) {
+        const TriangleLanes& tri = block.triangles;
+        const Lane* d = ray.direction;
+        Lane n[3], ao[3];
+        for (COUNTTYPE k = 0; k < 3; ++k) {
+            n[k] = Lane::load(tri.n[k]);
+            ao[k] = Lane::load(tri.a[k]) - ray.origin[k];
+        }
+        Lane deterA = d[0] * n[0] + d[1] * n[1] + d[2] * n[2];
+        Lane invDeterA = Lane::broadcast(1) / deterA;
+        t = (ao[0] * n[0] + ao[1] * n[1] + ao[2] * n[2]) * invDeterA;
+
+        Lane dao[3] = { d[1] * ao[2] - ao[1] * d[2],
+                        d[2] * ao[0] - ao[2] * d[0],
+                        d[0] * ao[1] - ao[0] * d[1] };
+        Lane beta = (dao[0] * Lane::load(tri.ca[0]) + dao[1] * Lane::load(tri.ca[1]) + 
+                     dao[2] * Lane::load(tri.ca[2])) * invDeterA;
+        Lane gamma = (dao[0] * Lane::load(tri.ab[0]) + dao[1] * Lane::load(tri.ab[1]) + 
+                      dao[2] * Lane::load(tri.ab[2])) * invDeterA;
+        Lane alpha = Lane::broadcast(1) - beta - gamma;
+
+        const Lane zero = Lane::broadcast(0), one = Lane::broadcast(1);
+        return !((deterA == zero) | (t < zero) | (beta < zero) | (beta > one) |
+                 (gamma < zero) | (gamma > one) | (alpha < zero) | (alpha > one));
+    }
+
+    static Lane::Mask intersect(const SphereBlock& block, const RayLanes& ray, Lane& t) {
+        Lane l[3];
+        for (COUNTTYPE k = 0; k < 3; ++k)
+            l[k] = Lane::load(block.center[k]) - ray.origin[k];
+        Lane lSqr = l[0] * l[0] + l[1] * l[1] + l[2] * l[2];
+        Lane tp = l[0] * ray.direction[0] + l[1] * ray.direction[1] + l[2] * ray.direction[2];
+        Lane rSqr = Lane::load(block.radiusSqr);
+        Lane dSqr = lSqr - tp * tp;
+        Lane tApos = (rSqr - dSqr).sqrt();
+
+        // origin of ray on the surface is taken as a miss
+        Lane::Mask outside = lSqr > rSqr;
+        t = Lane::select(outside, tp - tApos, tp + tApos);
+        return !((outside & (tp < Lane::broadcast(0))) | (dSqr > rSqr) | (lSqr == rSqr));
+    }
+
+    template < class BLOCK >
+    // material of lane k is mat, lanes are filled in order
+    void setMaterial(BLOCK& block, const COUNTTYPE k, const Material* mat) {
+        if (k == 0) block.opaque = 0;
+        block.materials[k] = mat? materialId(mat): 0;
+        if (mat && !mat -> isTransparent()) block.opaque |= 1 << k;
+    }
+
+    template < class BLOCK >
+    // true if the id and material of lane k are ones of the streams
+    bool isLane(const BLOCK& block, const COUNTTYPE k) const {
+        return block.ids[k] >= 0 && block.ids[k] < primitiveCount &&
+               block.materials[k] >= 0 && block.materials[k] < COUNTTYPE(materials.size());
+    }
+
+    // true if part of obj is a triangle, as Hit::primitive
+    static bool isPart(const Object* obj, const COUNTTYPE part) {
+        switch (obj -> type()) {
+            case Object::TRIANGLE: 
+                return part == 0;
+            case Object::RECTANGLE: 
+                return part == 0 || part == 1;
+            case Object::MESH: {
+                const TriangleMesh* mesh = static_cast<const TriangleMesh*>(obj);
+                return part >= 0 && part / 2 < mesh -> faceCount() && (part % 2 == 0 || mesh -> isQuad(part / 2));
+            }
+            default:
+                return 0;
+        }
+    }
+
+    // primitive of lane k from its object and part, as insert sets it
+    static void setLane(TriangleBlock& block, const COUNTTYPE k) {
+        const Object* obj = block.objects[k];
+        const COUNTTYPE part = block.parts[k];
+        if (!obj) return clearTriangle(block.triangles, k);
+        if (obj -> type() == Object::MESH) {
+            Point v[3];
+            static_cast<const TriangleMesh*>(obj) -> triangle(part / 2, part % 2, v);
+            return setTriangle(block.triangles, k, v[0], v[0] - v[1], v[2] - v[0]);
+        }
+        const Triangle& tri = obj -> type() == Object::TRIANGLE? *static_cast<const Triangle*>(obj): 
+                              static_cast<const Rectangle*>(obj) -> triangle(part);
+        setTriangle(block.triangles, k, tri.vertices(0), tri.ab(), tri.ca());
+    }
+
+    // negative squared radius is never intersected
+    static void setLane(SphereBlock& block, const COUNTTYPE k) {
+        const Sphere* sphere = static_cast<const Sphere*>(block.objects[k]);
+        for (COUNTTYPE i = 0; i < 3; ++i) block.center[i][k] = sphere? sphere -> center()[i]: 0;
+        block.radiusSqr[k] = sphere? sphere -> radius() * sphere -> radius(): -1;
+    }
+
+    static COUNTTYPE part(const TriangleBlock& block, const COUNTTYPE k) { return block.parts[k]; }
+    static COUNTTYPE part(const SphereBlock&, const COUNTTYPE) { return 0; }
+
+    template < class BLOCK >
+    // lowers hit.distance to the closest intersection in blocks
+    static bool intersect(const BLOCK* blocks, const COUNTTYPE count, const RayLanes& ray, Hit& hit) {
+        bool found = 0;
+        for (COUNTTYPE b = 0; b < count; ++b) {
+            if (!untested(blocks[b], ray)) {
+                ray.box -> avoided += used(blocks[b]);
+                continue;
+            }
+            ray.box -> tests += used(blocks[b]);
+            Lane t;
+            Lane::Mask intersected = intersect(blocks[b], ray, t);
+            int hits = (intersected & (t < Lane::broadcast(hit.distance))).bits();
+            // lanes in order, so the first of equally distant objects is kept
+            for (COUNTTYPE k = 0; hits; ++k, hits >>= 1) {
+                if (!(hits & 1) || !(t[k] < hit.distance)) continue;
+                hit.distance = t[k];
+                hit.object = blocks[b].objects[k];
+                hit.primitive = part(blocks[b], k);
+                hit.material = blocks[b].materials[k];
+                found = 1;
+            }
+        }
+        return found;
+    }
+
+    template < class BLOCK >
+    static bool occluded(const BLOCK* blocks, const COUNTTYPE count, const RayLanes& ray,
+                         const ELEMTYPE tMax) {
+        for (COUNTTYPE b = 0; b < count; ++b) {
+            if (!untested(blocks[b], ray)) {
+                ray.box -> avoided += used(blocks[b]);
+                continue;
+            }
+            ray.box -> tests += used(blocks[b]);
+            Lane t;
+            Lane::Mask hit = intersect(blocks[b], ray, t);
+            if ((hit & (t < Lane::broadcast(tMax))).bits() & blocks[b].opaque) return 1;
+        }
+        return 0;
+    }
+
+#ifdef DEBUG
+    template < class FUNC >
+    // func(intersected, distance, material) for each object of range in the blocks,
+    // a triangle of a mesh is tested alone
+    void forEachObject(const Range& range, const Ray& ray, FUNC func) const {
+        auto test = [&](const Object* o, const COUNTTYPE part, const COUNTTYPE mat) {
+            if (!o) return;
+            ELEMTYPE distance = 0;
+            bool intersected = o -> type() == Object::MESH? 
+                static_cast<const TriangleMesh*>(o) -> isIntersected(ray, distance, part):
+                o -> isIntersected(ray, distance);
+            func(intersected, distance, materials[mat]);
+        };
+        for (COUNTTYPE b = 0; b < range.triangleBlocks; ++b) {
+            const TriangleBlock& block = triangles[range.triangleBlock + b];
+            for (COUNTTYPE k = 0; k < WIDTH; ++k) test(block.objects[k], block.parts[k], block.materials[k]);
+        }
+        for (COUNTTYPE b = 0; b < range.sphereBlocks; ++b) {
+            const SphereBlock& block = spheres[range.sphereBlock + b];
+            for (COUNTTYPE k = 0; k < WIDTH; ++k) test(block.objects[k], 0, block.materials[k]);
+        }
+    }
+#endif
+
+public:
+    PrimitiveStreams(): primitiveCount(0), generation(0), _objectTests(0), _duplicateTestsAvoided(0) { }
+
+    void clear() {
+        triangles.clear();
+        spheres.clear();
+        primitiveIds.clear();
+        primitiveCount = 0;
+        materials.clear();
+        materialIds.clear();
+        generation = ++generations();
+        _objectTests = _duplicateTestsAvoided = 0;
+    }
+
+    // adds tests counted by the mailbox of lanes since the last call,
+    // called once a ray or packet is traced
+    void countTests(const RayLanes& lanes) const {
+        Mailbox& box = *lanes.box;
+        if (box.tests) _objectTests.fetch_add(box.tests, std::memory_order_relaxed);
+        if (box.avoided) _duplicateTestsAvoided.fetch_add(box.avoided, std::memory_order_relaxed);
+        box.tests = box.avoided = 0;
+    }
+    // primitives tested by all rays, each primitive of a block
+    // once a ray, the two triangles of a quad apart
+    unsigned long long objectTests() const { return _objectTests; }
+    // tests of primitives skipped since the ray tested them in another leaf
+    unsigned long long duplicateTestsAvoided() const { return _duplicateTestsAvoided; }
+
+    const Material& material(const COUNTTYPE id) const {
+        assert(id >= 0 && id < COUNTTYPE(materials.size()));
+        return materials[id];
+    }
+
+    template < class WRITER >
+    // writes the streams, objects are written as numbers given by out
+    // in place of the pointers in blocks
+    void save(WRITER& out) const {
+        out.write(primitiveCount);
+        out.write(COUNTTYPE(materials.size()));
+        for (auto& material: materials) out.write(material);
+        out.write(triangles);
+        for (auto& block: triangles) for (auto o: block.objects) out.object(o);
+        out.write(spheres);
+        for (auto& block: spheres) for (auto o: block.objects) out.object(o);
+    }
+
+    template < class READER >
+    // reads streams written by save, objects are taken from in by their numbers.
+    // lanes are checked with in.check() and their primitives are set again from
+    // their objects, so a corrupted file can't hit what isn't there.
+    // nothing more can be inserted until cleared
+    void load(READER& in) {
+        clear();
+        COUNTTYPE count;
+        in.read(primitiveCount);
+        in.readCount(count);
+        in.check(primitiveCount >= 0);
+        for (COUNTTYPE i = 0; i < count && in.good(); ++i) {
+            materials.push_back(Material(blackColor, 0, 0, 0, 0));
+            in.read(materials.back());
+        }
+        in.read(triangles);
+        for (auto& block: triangles) {
+            for (COUNTTYPE k = 0; k < WIDTH && in.good(); ++k) {
+                in.object(block.objects[k]);
+                if (in.check(isLane(block, k) && (!block.objects[k] || isPart(block.objects[k], block.parts[k]))))
+                    setLane(block, k);
+            }
+        }
+        in.read(spheres);
+        for (auto& block: spheres) {
+            for (COUNTTYPE k = 0; k < WIDTH && in.good(); ++k) {
+                in.object(block.objects[k]);
+                if (in.check(isLane(block, k) && (!block.objects[k] || block.objects[k] -> type() == Object::SPHERE)))
+                    setLane(block, k);
+            }
+        }
+    }
+
+    // true if range is in the streams
+    bool contains(const Range& range) const {
+        return range.triangleBlock >= 0 && range.triangleBlocks >= 0 &&
+               range.triangleBlocks <= COUNTTYPE(triangles.size()) - range.triangleBlock &&
+               range.sphereBlock >= 0 && range.sphereBlocks >= 0 &&
+               range.sphereBlocks <= COUNTTYPE(spheres.size()) - range.sphereBlock;
+    }
+
+    // copies primitives into the streams, returns where they are
+    Range insert(const Primitive* const* primitives, const COUNTTYPE count) {
+        // triangles as A, AB and CA, the objects they belong to and their ids
+        struct TriangleLane {
+            Point a;
+            Vector ab, ca;
+            const Object* object;
+            COUNTTYPE part;
+            const Material* material;
+            COUNTTYPE id;
+        };
+        std::vector<TriangleLane> tris;
+        std::vector<const Sphere*> sphs;
+        std::vector<COUNTTYPE> sphereIds;
+        Range range;
+        for (COUNTTYPE i = 0; i < count; ++i) {
+            const Object* obj = primitives[i] -> object();
+            switch (obj -> type()) {
+                case Object::TRIANGLE: {
+                    const Triangle* tri = static_cast<const Triangle*>(obj);
+                    tris.push_back(TriangleLane{ tri -> vertices(0), tri -> ab(), tri -> ca(), 
+                                                 obj, 0, obj -> material(), id(primitives[i], 1) });
+                    break;
+                }
+                case Object::RECTANGLE: {
+                    COUNTTYPE first = id(primitives[i], 2);
+                    for (COUNTTYPE k = 0; k < 2; ++k) {
+                        const Triangle& tri = static_cast<const Rectangle*>(obj) -> triangle(k);
+                        tris.push_back(TriangleLane{ tri.vertices(0), tri.ab(), tri.ca(), 
+                                                     obj, k, obj -> material(), first + k });
+                    }
+                    break;
+                }
+                case Object::MESH: {
+                    const TriangleMesh* mesh = static_cast<const TriangleMesh*>(obj);
+                    COUNTTYPE f = primitives[i] -> face();
+                    COUNTTYPE halves = mesh -> isQuad(f)? 2: 1;
+                    COUNTTYPE first = id(primitives[i], halves);
+                    for (COUNTTYPE k = 0; k < halves; ++k) {
+                        Point v[3];
+                        mesh -> triangle(f, k, v);
+                        tris.push_back(TriangleLane{ v[0], v[0] - v[1], v[2] - v[0], 
+                                                     obj, 2 * f + k, mesh -> faceMaterial(f), first + k });
+                    }
+                    break;
+                }
+                case Object::SPHERE:
+                    sphs.push_back(static_cast<const Sphere*>(obj));
+                    sphereIds.push_back(id(primitives[i], 1));
+                    break;
+                default:
+                    assert(0); // should never happen
+            }
+        }
+
+        range.triangleBlock = triangles.size();
+        range.triangleBlocks = (tris.size() + WIDTH - 1) / WIDTH;
+        triangles.resize(triangles.size() + range.triangleBlocks);
+        for (COUNTTYPE i = 0; i < range.triangleBlocks * WIDTH; ++i) {
+            TriangleBlock& block = triangles[range.triangleBlock + i / WIDTH];
+            bool used = i < COUNTTYPE(tris.size());
+            if (used) setTriangle(block.triangles, i % WIDTH, tris[i].a, tris[i].ab, tris[i].ca);
+            else clearTriangle(block.triangles, i % WIDTH);
+            block.objects[i % WIDTH] = used? tris[i].object: nullptr;
+            block.parts[i % WIDTH] = used? tris[i].part: 0;
+            setMaterial(block, i % WIDTH, used? tris[i].material: nullptr);
+            block.ids[i % WIDTH] = used? tris[i].id: block.ids[0];
+        }
+
+        range.sphereBlock = spheres.size();
+        range.sphereBlocks = (sphs.size() + WIDTH - 1) / WIDTH;
+        spheres.resize(spheres.size() + range.sphereBlocks);
+        for (COUNTTYPE i = 0; i < range.sphereBlocks * WIDTH; ++i) {
+            SphereBlock& block = spheres[range.sphereBlock + i / WIDTH];
+            bool used = i < COUNTTYPE(sphs.size());
+            block.objects[i % WIDTH] = used? sphs[i]: nullptr;
+            setLane(block, i % WIDTH);
+            setMaterial(block, i % WIDTH, used? sphs[i] -> material(): nullptr);
+            block.ids[i % WIDTH] = used? sphereIds[i]: block.ids[0];
+        }
+        return range;
+    }
+
+    // lowers hit.distance to the distance of the closest object in range intersected by ray,
+    // and sets hit.object, hit.primitive and hit.material to it. returns false if there's no object 
+    // closer than hit.distance. the rest of hit is left to Object::fillHit
+    bool intersect(const Range& range, const RayLanes& lanes, Hit& hit) const {
+#if defined(DEBUG) && !defined(SINGLE_PRECISION)
+        const ELEMTYPE initialClosest = hit.distance;
+#endif
+        bool found = 0;
+        found |= intersect(triangles.data() + range.triangleBlock, range.triangleBlocks, lanes, hit);
+        found |= intersect(spheres.data() + range.sphereBlock, range.sphereBlocks, lanes, hit);
+#if defined(DEBUG) && !defined(SINGLE_PRECISION)
+        // objects intersected one by one should give the same distance, 
+        // up to rounding. not checked in float, where grazing rays and rays
+        // ending on a surface may be told apart differently by the two formulas
+        ELEMTYPE expected = initialClosest;
+        forEachObject(range, *lanes.ray, [&](const bool intersected, const ELEMTYPE distance, const Material&) {
+            if (intersected && distance < expected) expected = distance;
+        });
+        assert(std::abs(expected - hit.distance) <= EPSILON * std::max(ELEMTYPE(1), std::abs(expected)));
+#endif
+        return found;
+    }
+
+    // returns true if any opaque object in range is intersected by ray within distance tMax
+    bool occluded(const Range& range, const RayLanes& lanes, const ELEMTYPE tMax) const {
+        bool blocked = occluded(triangles.data() + range.triangleBlock, range.triangleBlocks, lanes, tMax) ||
+                       occluded(spheres.data() + range.sphereBlock, range.sphereBlocks, lanes, tMax);
+#if defined(DEBUG) && !defined(SINGLE_PRECISION)
+        // objects intersected at about tMax, such as the other wall at a corner,
+        // may be taken either way
+        bool expected = 0, tie = 0;
+        forEachObject(range, *lanes.ray, [&](const bool intersected, const ELEMTYPE distance, const Material& mat) {
+            if (mat.isTransparent() || !intersected) return;
+            if (distance < tMax) expected = 1;
+            if (std::abs(distance - tMax) <= EPSILON * std::max(ELEMTYPE(1), tMax)) tie = 1;
+        });
+        assert(blocked == expected || tie);
+#endif
+        return blocked;
+    }
+};
+
+#endif /* PRIMITIVES_H */
@@ -22,19 +22,27 @@ class Ray {
     Vector _direction;
     ELEMTYPE _refractiveIndex; // the refractiveIndex of the medium the ray in
     ELEMTYPE _intensity;
+    // ray cone, a ray differential for filtering textures: the footprint of 
+    // the ray is _width wide at origin and grows by _spread per unit distance
+    ELEMTYPE _width;
+    ELEMTYPE _spread;
 public:
     Ray(const Point& o, const Vector& d, 
         const ELEMTYPE r = 1.0, const ELEMTYPE i = 1.0): 
-        _origin(o), _direction(d), _refractiveIndex(r), _intensity(i) {
+        _origin(o), _direction(d), _refractiveIndex(r), _intensity(i), _width(0), _spread(0) {
         // direciton is unit vector
         _direction = _direction.normalize();
     } 
     void setIntensity(const ELEMTYPE i) { _intensity = i; }
     void setRefractiveIndex(const ELEMTYPE r) { _refractiveIndex = r; }
+    void setCone(const ELEMTYPE width, const ELEMTYPE spread) { _width = width; _spread = spread; }
     Vector origin() const { return _origin; }
     Vector direction() const { return _direction; }
     ELEMTYPE intensity() const { return _intensity; }
     ELEMTYPE refractiveIndex() const { return _refractiveIndex; }
+    ELEMTYPE spread() const { return _spread; }
+    // width of the cone at distance from origin
+    ELEMTYPE footprint(const ELEMTYPE distance) const { return _width + _spread * distance; }
 
 };
 
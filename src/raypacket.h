@@ -0,0 +1,105 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: raypacket.h
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 19:26:05
+ *  Description: A few rays going about the same way, traced together
+ *               through the acceleration structure. Each node is visited
+ *               once for all of them and its box is tested with all rays
+ *               in lanes.
+ *****************************************************************************/
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+
+#include <vector>
+#include <limits>
+#include "common.h"
+#include "simd.h"
+#include "ray.h"
+#include "primitives.h"
+
+using namespace RayTracing;
+
+class RayPacket {
+public:
+    constexpr static COUNTTYPE MAXSIZE = 8;
+
+private:
+    typedef Lanes<ELEMTYPE> Lane;
+    constexpr static COUNTTYPE WIDTH = Lane::WIDTH;
+    // lanes are padded to whole registers, padding rays hit nothing
+    constexpr static COUNTTYPE PADDEDSIZE = (MAXSIZE + WIDTH - 1) / WIDTH * WIDTH;
+
+    COUNTTYPE _size;
+    ELEMTYPE _origin[3][PADDEDSIZE];
+    ELEMTYPE _direction[3][PADDEDSIZE];
+    ELEMTYPE _invDirection[3][PADDEDSIZE];
+
+public:
+    // distance of the closest intersection found so far of each ray
+    ELEMTYPE closest[PADDEDSIZE];
+    // the closest hit of each ray, its object is null if none
+    Hit hits[MAXSIZE];
+    PrimitiveStreams::RayLanes lanes[MAXSIZE];
+
+    RayPacket(const std::vector<Ray>& rays, const PrimitiveStreams& primitives): _size(rays.size()) {
+        assert(_size > 0 && _size <= MAXSIZE);
+        for (COUNTTYPE r = 0; r < PADDEDSIZE; ++r) {
+            bool used = r < _size;
+            Vector o = used? rays[r].origin(): Vector(0, 0, 0);
+            Vector d = used? rays[r].direction(): Vector(1, 1, 1);
+            for (COUNTTYPE k = 0; k < 3; ++k) {
+                _origin[k][r] = o[k];
+                _direction[k][r] = d[k];
+            }
+            closest[r] = used? std::numeric_limits<ELEMTYPE>::max(): -1;
+        }
+        for (COUNTTYPE k = 0; k < 3; ++k)
+            for (COUNTTYPE r = 0; r < PADDEDSIZE; r += WIDTH)
+                (Lane::broadcast(1) / Lane::load(_direction[k] + r)).store(_invDirection[k] + r);
+        for (COUNTTYPE r = 0; r < _size; ++r) {
+            if (r) lanes[r].set(rays[r], lanes[0], r);
+            else lanes[r].set(rays[r], primitives);
+        }
+    }
+
+    COUNTTYPE size() const { return _size; }
+    // k-th coordinate of all rays
+    const ELEMTYPE* origin(const COUNTTYPE k) const { return _origin[k]; }
+    const ELEMTYPE* direction(const COUNTTYPE k) const { return _direction[k]; }
+    const ELEMTYPE* invDirection(const COUNTTYPE k) const { return _invDirection[k]; }
+    // bit r is set for each ray r
+    unsigned all() const { return (1u << _size) - 1; }
+
+    // slab test of box with rays in mask, returns those entering
+    // the box before their closest intersection
+    unsigned entering(const ELEMTYPE minBound[3], const ELEMTYPE maxBound[3], const unsigned mask) const {
+        unsigned result = 0;
+        const Lane zero = Lane::broadcast(0);
+        for (COUNTTYPE r = 0; r < _size; r += WIDTH) {
+            if (!(mask >> r & ((1u << WIDTH) - 1))) continue;
+            Lane tNear = zero;
+            Lane tFar = Lane::load(closest + r);
+            for (COUNTTYPE k = 0; k < 3; ++k) {
+                Lane inv = Lane::load(_invDirection[k] + r);
+                Lane o = Lane::load(_origin[k] + r);
+                Lane::Mask negative = inv < zero;
+                Lane lower = Lane::broadcast(minBound[k]), upper = Lane::broadcast(maxBound[k]);
+                Lane t0 = (Lane::select(negative, upper, lower) - o) * inv;
+                Lane t1 = (Lane::select(negative, lower, upper) - o) * inv;
+                // NaN (origin on the slab of a flat box) is dropped by max/min
+                tNear = t0.max(tNear);
+                tFar = t1.min(tFar);
+            }
+            result |= unsigned((!(tNear > tFar)).bits()) << r;
+        }
+        return result & mask;
+    }
+};
+
+#endif /* RAYPACKET_H */
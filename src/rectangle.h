@@ -21,85 +21,74 @@ class Rectangle: public Object {
     Point _vertices[4];
     Triangle _tri0;
     Triangle _tri1;
+    // unit normal, unit texture axes along the sides from the first vertex
+    // and the lengths of the sides
+    Vector _normal;
+    Vector _xAxis;
+    Vector _yAxis;
+    ELEMTYPE _xLength;
+    ELEMTYPE _yLength;
 public:
     Rectangle(const Point& p0, const Point& p1, const Point& p2, const Point& p3, 
               const Material* mat, const Texture* tex): 
-        Object(mat, tex), _tri0(p0, p1, p2, mat, tex), _tri1(p0, p2, p3, mat, tex) { 
+        Object(RECTANGLE, mat, tex), _tri0(p0, p1, p2, mat, tex), _tri1(p0, p2, p3, mat, tex) { 
         _vertices[0] = p0;
         _vertices[1] = p1;
         _vertices[2] = p2;
         _vertices[3] = p3;
-        assert((Vector(p0 - p1) - Vector(p3 - p2)).norm() < EPSILON);
-        assert((Vector(p0 - p3) - Vector(p1 - p2)).norm() < EPSILON);
-        assert(Vector(p0 - p1) * Vector(p0 - p3) < EPSILON);
+        assert(isRectangle(p0, p1, p2, p3));
+
+        _normal = crossProduct(p1 - p0, p2 - p0).normalize();
+        assert((_normal - crossProduct(p2 - p0, p3 - p0).normalize()).norm() < EPSILON);
+        _xAxis = (p1 - p0).normalize();
+        _yAxis = (p3 - p0).normalize();
+        _xLength = (p1 - p0).norm();
+        _yLength = (p3 - p0).norm();
+
+        Point lower, upper;
+        for (COUNTTYPE k = 0; k < 3; ++k) {
+            lower[k] = std::min(std::min(p0[k], p1[k]), std::min(p2[k], p3[k]));
+            upper[k] = std::max(std::max(p0[k], p1[k]), std::max(p2[k], p3[k]));
+            // the box of a flat rectangle should have some thickness
+            if (lower[k] == upper[k]) {
+                lower[k] -= EPSILON;
+                upper[k] += EPSILON;
+            }
+        }
+        setBounds(lower, upper);
     }
 
     virtual ~Rectangle() { }
 
-    ELEMTYPE lowerBoundX() const { 
-        ELEMTYPE lbx = std::min(std::min(_vertices[0][0], _vertices[1][0]), std::min(_vertices[2][0], _vertices[3][0])); 
-        ELEMTYPE ubx = std::max(std::max(_vertices[0][0], _vertices[1][0]), std::max(_vertices[2][0], _vertices[3][0])); 
-        if (lbx == ubx) return lbx - EPSILON;
-        return lbx;
-    }
-    ELEMTYPE upperBoundX() const { 
-        ELEMTYPE lbx = std::min(std::min(_vertices[0][0], _vertices[1][0]), std::min(_vertices[2][0], _vertices[3][0])); 
-        ELEMTYPE ubx = std::max(std::max(_vertices[0][0], _vertices[1][0]), std::max(_vertices[2][0], _vertices[3][0])); 
-        if (lbx == ubx) return ubx + EPSILON;
-        return ubx;
-    }
-    ELEMTYPE lowerBoundY() const { 
-        ELEMTYPE lby = std::min(std::min(_vertices[0][1], _vertices[1][1]), std::min(_vertices[2][1], _vertices[3][1])); 
-        ELEMTYPE uby = std::max(std::max(_vertices[0][1], _vertices[1][1]), std::max(_vertices[2][1], _vertices[3][1])); 
-        if (lby == uby) return lby - EPSILON;
-        return lby;
-    }
-    ELEMTYPE upperBoundY() const { 
-        ELEMTYPE lby = std::min(std::min(_vertices[0][1], _vertices[1][1]), std::min(_vertices[2][1], _vertices[3][1])); 
-        ELEMTYPE uby = std::max(std::max(_vertices[0][1], _vertices[1][1]), std::max(_vertices[2][1], _vertices[3][1])); 
-        if (lby == uby) return uby + EPSILON;
-        return uby;
-    }
-    ELEMTYPE lowerBoundZ() const { 
-        ELEMTYPE lbz = std::min(std::min(_vertices[0][2], _vertices[1][2]), std::min(_vertices[2][2], _vertices[3][2])); 
-        ELEMTYPE ubz = std::max(std::max(_vertices[0][2], _vertices[1][2]), std::max(_vertices[2][2], _vertices[3][2])); 
-        if (lbz == ubz) return lbz - EPSILON;
-        return lbz;
-    }
-    ELEMTYPE upperBoundZ() const { 
-        ELEMTYPE lbz = std::min(std::min(_vertices[0][2], _vertices[1][2]), std::min(_vertices[2][2], _vertices[3][2])); 
-        ELEMTYPE ubz = std::max(std::max(_vertices[0][2], _vertices[1][2]), std::max(_vertices[2][2], _vertices[3][2])); 
-        if (lbz == ubz) return ubz + EPSILON;
-        return ubz;
+    // p0, p1, p2, p3 in order are the vertices of a rectangle, which isn't a point or a segment
+    static bool isRectangle(const Point& p0, const Point& p1, const Point& p2, const Point& p3) {
+        return (Vector(p0 - p1) - Vector(p3 - p2)).norm() < EPSILON &&
+               (Vector(p0 - p3) - Vector(p1 - p2)).norm() < EPSILON &&
+               Vector(p0 - p1) * Vector(p0 - p3) < EPSILON &&
+               crossProduct(p1 - p0, p3 - p0).norm() > 0;
     }
 
-    Point& vertices(const COUNTTYPE k) {
+    const Point& vertices(const COUNTTYPE k) const {
         assert(k >= 0 && k < 4);
         return _vertices[k];
     }
 
-    Color texture(const Point& p) const {
-        // if there's not texture
-        if (!_texture) return color();
-        
-        Vector xAxis = (_vertices[1] - _vertices[0]);
-        Vector yAxis = (_vertices[3] - _vertices[0]);
-
-        ELEMTYPE pX = (p - _vertices[0]) * xAxis.normalize();
-        ELEMTYPE pY = (p - _vertices[0]) * yAxis.normalize();
-
-        return _texture -> getPixel(pX, pY, xAxis.norm(), yAxis.norm());
+    // the two triangles intersected in place of the rectangle
+    const Triangle& triangle(const COUNTTYPE k) const {
+        assert(k >= 0 && k < 2);
+        return k? _tri1: _tri0;
     }
 
-    Color color() const { return _material -> color(); }
+    // the rectangle has a texture
+    Color texture(const Hit& hit) const {
+        return _texture -> getPixel(hit.u, hit.v, _xLength, _yLength, hit.footprint);
+    }
 
-    Vector normal(const Point&) const {
-        Vector tmp = crossProduct(_vertices[1] - _vertices[0],
-                                    _vertices[2] - _vertices[0]).normalize();
-        Vector tmp1 = crossProduct(_vertices[2] - _vertices[0],
-                                     _vertices[3] - _vertices[0]).normalize();
-        assert((tmp - tmp1).norm() < EPSILON);
-        return tmp;
+    void fillHit(const Ray& ray, Hit& hit) const {
+        hit.point = ray.origin() + hit.distance * ray.direction();
+        hit.normal = _normal;
+        hit.u = (hit.point - _vertices[0]) * _xAxis;
+        hit.v = (hit.point - _vertices[0]) * _yAxis;
     }
 
     INTERSECTED_TYPE isIntersected(const Ray& ray, ELEMTYPE& distance) const {
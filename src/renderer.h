@@ -0,0 +1,288 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: renderer.h
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 15:12:08
+ *  Description: Renderer traces the pixels of a tile and writes them to
+ *               the frame buffer. With adaptive sampling, a pixel stops
+ *               taking rays once its color is estimated precisely enough.
+ *               With edge adaptive anti-aliasing, only pixels differing
+ *               from their neighbors take all anti-aliasing rays.
+ *               Pixels of a tile are traced together in rounds, rays of
+ *               all of them pass the stages of the scene at once.
+ *****************************************************************************/
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <cmath>
+#include "common.h"
+#include "scene.h"
+#include "camera.h"
+#include "sampler.h"
+#include "framebuffer.h"
+
+using namespace RayTracing;
+
+class Renderer {
+public:
+    // SUPERSAMPLING: every pixel takes camera.raysPerPixel() rays
+    // EDGE_ADAPTIVE: every pixel takes edge rays first, one a stratum by default,
+    //                pixels on edges then take the rest
+    enum AATYPE { SUPERSAMPLING = 0, EDGE_ADAPTIVE = 1 };
+
+private:
+    // running estimate of a pixel's color
+    struct Estimate {
+        Color color;
+        // weighted mean and variance of luminance of rays,
+        // weighted the same way as colors are mixed
+        ELEMTYPE sumWeight, sumSqrWeight, mean, m2;
+        COUNTTYPE rays;
+        // reflected and refracted rays spawned by all rays, for the path budget
+        COUNTTYPE secondaryRays;
+        bool converged;
+        Estimate(): color(0, 0, 0, 0), sumWeight(0), sumSqrWeight(0), mean(0), m2(0),
+                    rays(0), secondaryRays(0), converged(0) { }
+    };
+
+    const Scene& scene;
+    const Camera& camera;
+    FrameBuffer& frameBuffer;
+
+    Sampler::SAMPLERTYPE _samplerType;
+    uint32_t _seed;
+
+    // adaptive sampling is disabled if noise threshold is 0
+    // otherwise a pixel takes at least _minRays rays, and stops when the
+    // standard error of its mean luminance is below noise threshold
+    ELEMTYPE _noiseThreshold;
+    COUNTTYPE _minRays;
+
+    // rays traced together through the scene, 1 to trace them one by one
+    COUNTTYPE _packetSize;
+    // secondary rays are sorted by direction and origin before they're traced
+    bool _sortRays;
+
+    AATYPE _aaType;
+    // difference of luminance to a neighbor beyond which a pixel is on an edge
+    ELEMTYPE _edgeThreshold;
+    // rays of every pixel before edges are found, 0 for one a stratum
+    COUNTTYPE _edgeRays;
+
+    // number of pixels by number of rays traced for them
+    std::vector<unsigned long long> _raysHistogram;
+    // secondary rays pruned for the path budget of the scene
+    Scene::Wavefront::Pruned _pruned;
+    std::mutex histogramLock;
+
+    static ELEMTYPE luminance(const Color& c) {
+        return ELEMTYPE(0.299) * c.red() + ELEMTYPE(0.587) * c.green() + ELEMTYPE(0.114) * c.blue();
+    }
+
+    // a pixel being traced, its rays of the current round are
+    // those from first on in the rays of the round
+    struct PendingPixel {
+        COUNTTYPE x, y;
+        Estimate* estimate;
+        COUNTTYPE first, count;
+        PendingPixel(const COUNTTYPE px, const COUNTTYPE py, Estimate* e): 
+            x(px), y(py), estimate(e), first(0), count(0) { }
+    };
+
+    // storage reused by all rounds of a tile. rays[i] is of pending pixel pixels[i],
+    // which has spawned secondaryRays[pixels[i]] secondary rays
+    struct Buffers {
+        std::vector<PendingPixel> pending;
+        std::vector<Ray> rays;
+        std::vector<COUNTTYPE> pixels, secondaryRays;
+        std::vector<Color> colors;
+        Scene::Wavefront wavefront;
+    };
+
+    // mixes colors of rays of a pixel into its estimate, 
+    // and checks if it's converged after them
+    void addColors(Estimate& e, const Color* colors, const COUNTTYPE count, const COUNTTYPE minRays) const {
+        for (COUNTTYPE i = 0; i < count; ++i) {
+            const Color& color = colors[i];
+            e.color += color;
+            ++e.rays;
+
+            if (_noiseThreshold <= 0 || color.weight() <= 0) continue;
+            ELEMTYPE w = color.weight();
+            ELEMTYPE l = luminance(color);
+            ELEMTYPE delta = l - e.mean;
+            e.sumWeight += w;
+            e.sumSqrWeight += w * w;
+            e.mean += delta * w / e.sumWeight;
+            e.m2 += w * delta * (l - e.mean);
+        }
+
+        if (_noiseThreshold <= 0 || e.rays < minRays || e.sumWeight <= 0) return;
+        // variance of the weighted mean is variance / effective number of rays
+        ELEMTYPE variance = e.m2 / e.sumWeight;
+        ELEMTYPE effectiveRays = e.sumWeight * e.sumWeight / e.sumSqrWeight;
+        e.converged = variance / effectiveRays < _noiseThreshold * _noiseThreshold;
+    }
+
+    // continues tracing pending pixels until each takes maxRays rays or converges.
+    // in each round every pixel left takes a packet of rays, rays of all of them
+    // go through the scene together, then convergence is checked pixel by pixel
+    void tracePixels(Buffers& b, Sampler& sampler, const COUNTTYPE maxRays) const {
+        // every stratum of the pixel is sampled before it may converge
+        const COUNTTYPE minRays = std::max(_minRays, camera.aaRatio() * camera.aaRatio());
+        size_t left = 0;
+        for (size_t i = 0; i < b.pending.size(); ++i)
+            if (b.pending[i].estimate -> rays < maxRays && !b.pending[i].estimate -> converged) 
+                b.pending[left++] = b.pending[i];
+        b.pending.erase(b.pending.begin() + left, b.pending.end());
+
+        while (b.pending.size()) {
+            b.rays.clear();
+            b.pixels.clear();
+            b.secondaryRays.clear();
+            for (PendingPixel& p: b.pending) {
+                const Estimate& e = *p.estimate;
+                p.first = b.rays.size();
+                p.count = std::min(_packetSize, maxRays - e.rays);
+                sampler.startPixel(p.x, p.y);
+                for (COUNTTYPE i = e.rays; i < e.rays + p.count; ++i) {
+                    b.rays.push_back(camera.getRay(p.x, p.y, i, sampler));
+                    b.pixels.push_back(b.secondaryRays.size());
+                }
+                b.secondaryRays.push_back(e.secondaryRays);
+            }
+            scene.rayTrace(b.rays, b.pixels, b.secondaryRays, b.colors, b.wavefront, _packetSize, _sortRays);
+
+            left = 0;
+            for (size_t i = 0; i < b.pending.size(); ++i) {
+                Estimate& e = *b.pending[i].estimate;
+                e.secondaryRays = b.secondaryRays[i];
+                addColors(e, b.colors.data() + b.pending[i].first, b.pending[i].count, minRays);
+                if (e.rays < maxRays && !e.converged) b.pending[left++] = b.pending[i];
+            }
+            b.pending.erase(b.pending.begin() + left, b.pending.end());
+        }
+    }
+
+    // whether pixel (x, y) of region differs from any of its neighbors in region
+    bool onEdge(const FrameBuffer::Tile& region, const std::vector<Estimate>& estimates,
+                const COUNTTYPE x, const COUNTTYPE y) const {
+        ELEMTYPE l = luminance(estimates[(y - region.y0) * region.length() + x - region.x0].color);
+        for (COUNTTYPE j = std::max(y - 1, region.y0); j < std::min(y + 2, region.y1); ++j)
+            for (COUNTTYPE i = std::max(x - 1, region.x0); i < std::min(x + 2, region.x1); ++i)
+                if (std::abs(luminance(estimates[(j - region.y0) * region.length() + i - region.x0].color) - l) 
+                    > _edgeThreshold) 
+                    return 1;
+        return 0;
+    }
+
+public:
+    Renderer(const Scene& s, const Camera& c, FrameBuffer& fb):
+        scene(s), camera(c), frameBuffer(fb),
+        _samplerType(Sampler::RANDOM), _seed(0),
+        _noiseThreshold(0), _minRays(8), _packetSize(RayPacket::MAXSIZE), _sortRays(0),
+        _aaType(SUPERSAMPLING), _edgeThreshold(16), _edgeRays(0),
+        _raysHistogram(c.raysPerPixel() + 1, 0) {
+    }
+
+    void setSampler(const Sampler::SAMPLERTYPE type, const uint32_t seed) {
+        _samplerType = type;
+        _seed = seed;
+    }
+
+    // threshold is standard error of pixel luminance, in [0, 255]
+    void setAdaptiveSampling(const ELEMTYPE noiseThreshold, const COUNTTYPE minRays) {
+        assert(noiseThreshold >= 0 && minRays > 0);
+        _noiseThreshold = noiseThreshold;
+        _minRays = minRays;
+    }
+
+    void setPacketSize(const COUNTTYPE packetSize) {
+        assert(packetSize > 0 && packetSize <= RayPacket::MAXSIZE);
+        _packetSize = packetSize;
+    }
+
+    void setRaySorting(const bool sortRays) { _sortRays = sortRays; }
+
+    // edge threshold is difference of luminance, in [0, 255].
+    // edge rays are taken by every pixel first, 0 for one a stratum
+    void setAntiAliasing(const AATYPE type, const ELEMTYPE edgeThreshold, const COUNTTYPE edgeRays = 0) {
+        assert(edgeThreshold >= 0 && edgeRays >= 0);
+        _aaType = type;
+        _edgeThreshold = edgeThreshold;
+        _edgeRays = edgeRays;
+    }
+
+    // traces tile t of frame buffer, tiles can be rendered in parallel
+    void renderTile(const COUNTTYPE t) {
+        FrameBuffer::Tile tile = frameBuffer.tile(t);
+        // with edge adaptive anti-aliasing, the first pass also traces
+        // a border of one pixel around the tile to find edges on tile borders
+        FrameBuffer::Tile region = tile;
+        if (_aaType == EDGE_ADAPTIVE) {
+            region.x0 = std::max(tile.x0 - 1, 0);
+            region.y0 = std::max(tile.y0 - 1, 0);
+            region.x1 = std::min(tile.x1 + 1, frameBuffer.length());
+            region.y1 = std::min(tile.y1 + 1, frameBuffer.width());
+        }
+
+        Sampler sampler(_samplerType, _seed);
+        Buffers buffers;
+        std::vector<Estimate> estimates(region.length() * region.width());
+        // independent of the rays of depth of field, so edge adaptive anti-aliasing
+        // saves rays whenever a pixel takes more than one a stratum
+        COUNTTYPE firstPassRays = camera.raysPerPixel();
+        if (_aaType == EDGE_ADAPTIVE) 
+            firstPassRays = std::min(_edgeRays? _edgeRays: camera.aaRatio() * camera.aaRatio(), firstPassRays);
+        for (COUNTTYPE k = 0; k < region.mortonCount(); ++k) {
+            COUNTTYPE x, y;
+            if (!region.mortonPixel(k, x, y)) continue;
+            buffers.pending.push_back(PendingPixel(x, y, &estimates[(y - region.y0) * region.length() + x - region.x0]));
+        }
+        tracePixels(buffers, sampler, firstPassRays);
+
+        // edges are found on first pass colors only, so tiles agree on their borders.
+        // pixels on edges go on from copies of their estimates
+        std::vector<Estimate> tileEstimates(tile.length() * tile.width());
+        for (COUNTTYPE k = 0; k < tile.mortonCount(); ++k) {
+            COUNTTYPE x, y;
+            if (!tile.mortonPixel(k, x, y)) continue;
+            Estimate& e = tileEstimates[(y - tile.y0) * tile.length() + x - tile.x0];
+            e = estimates[(y - region.y0) * region.length() + x - region.x0];
+            if (firstPassRays < camera.raysPerPixel() && onEdge(region, estimates, x, y))
+                buffers.pending.push_back(PendingPixel(x, y, &e));
+        }
+        tracePixels(buffers, sampler, camera.raysPerPixel());
+
+        std::vector<Color> pixels(tile.length() * tile.width(), Color(0, 0, 0, 0));
+        std::vector<unsigned long long> raysHistogram(_raysHistogram.size(), 0);
+        for (size_t i = 0; i < tileEstimates.size(); ++i) {
+            pixels[i] = tileEstimates[i].color;
+            ++raysHistogram[tileEstimates[i].rays];
+        }
+        frameBuffer.resolve(tile, pixels);
+
+        std::lock_guard<std::mutex> guard(histogramLock);
+        for (size_t k = 0; k < raysHistogram.size(); ++k)
+            _raysHistogram[k] += raysHistogram[k];
+        const Scene::Wavefront::Pruned& pruned = buffers.wavefront.pruned();
+        _pruned.depth += pruned.depth;
+        _pruned.weight += pruned.weight;
+        _pruned.roulette += pruned.roulette;
+        _pruned.budget += pruned.budget;
+    }
+
+    // k-th element is the number of camera pixels traced with k rays
+    const std::vector<unsigned long long>& raysHistogram() const { return _raysHistogram; }
+    const Scene::Wavefront::Pruned& pruned() const { return _pruned; }
+};
+
+#endif /* RENDERER_H */
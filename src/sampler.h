@@ -0,0 +1,121 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: sampler.h
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 14:05:37
+ *  Description: Sample generator owned by one thread. Samples of a pixel
+ *               depend only on the pixel and the seed, so images are the
+ *               same no matter how many threads render them.
+ *****************************************************************************/
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+#include "common.h"
+
+using namespace RayTracing;
+
+class Sampler {
+public:
+    // RANDOM: independent pseudo random numbers
+    // HALTON: low discrepancy Halton sequence, randomly shifted per pixel
+    enum SAMPLERTYPE { RANDOM = 0, HALTON = 1 };
+
+private:
+    constexpr static COUNTTYPE MAXDIMENSION = 8;
+
+    SAMPLERTYPE _type;
+    uint32_t _seed;
+    // state of PCG32 generator, and its state at the start of current pixel
+    uint64_t _state;
+    uint64_t _pixelState;
+    // position in Halton sequence
+    COUNTTYPE _sampleIndex;
+    COUNTTYPE _dimension;
+    // per pixel random shift of each dimension of Halton sequence
+    ELEMTYPE _shift[MAXDIMENSION];
+
+    // PCG32, http://www.pcg-random.org
+    uint32_t nextUInt() {
+        uint64_t old = _state;
+        _state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint32_t xorShifted = uint32_t(((old >> 18) ^ old) >> 27);
+        uint32_t rot = uint32_t(old >> 59);
+        return (xorShifted >> rot) | (xorShifted << ((32 - rot) & 31));
+    }
+
+    ELEMTYPE uniform() {
+        // 24 bits so the result is below 1 in single precision too
+        return ELEMTYPE(nextUInt() >> 8) * (ELEMTYPE(1) / (1 << 24));
+    }
+
+    static ELEMTYPE radicalInverse(const COUNTTYPE dimension, COUNTTYPE index) {
+        static const COUNTTYPE primes[MAXDIMENSION] = { 2, 3, 5, 7, 11, 13, 17, 19 };
+        const COUNTTYPE base = primes[dimension];
+        const ELEMTYPE invBase = ELEMTYPE(1) / base;
+        ELEMTYPE invBaseN = 1, result = 0;
+        while (index > 0) {
+            invBaseN *= invBase;
+            result += (index % base) * invBaseN;
+            index /= base;
+        }
+        return result;
+    }
+
+public:
+    // mixes bits of x, others draw their own random numbers from it too
+    static uint32_t hash(uint32_t x) {
+        x ^= x >> 16;
+        x *= 0x7feb352dU;
+        x ^= x >> 15;
+        x *= 0x846ca68bU;
+        x ^= x >> 16;
+        return x;
+    }
+
+    Sampler(const SAMPLERTYPE type = RANDOM, const uint32_t seed = 0):
+        _type(type), _seed(seed), _state(0), _pixelState(0), _sampleIndex(0), _dimension(0) {
+        startPixel(0, 0);
+    }
+
+    SAMPLERTYPE type() const { return _type; }
+
+    // restarts the sequence for pixel (x, y)
+    void startPixel(const COUNTTYPE x, const COUNTTYPE y) {
+        _state = (uint64_t(hash(uint32_t(x) ^ hash(uint32_t(y) ^ hash(_seed)))) << 32)
+                 | hash(uint32_t(x) * 0x9e3779b9U + uint32_t(y));
+        nextUInt();
+        for (COUNTTYPE d = 0; d < MAXDIMENSION; ++d) _shift[d] = uniform();
+        _pixelState = _state;
+        startSample(0);
+    }
+
+    // dimensions of a sample are taken by next() in order.
+    // a sample depends only on its pixel and index, so samples
+    // of a pixel can be taken in several passes
+    void startSample(const COUNTTYPE index) {
+        _sampleIndex = index;
+        _dimension = 0;
+        _state = _pixelState ^ ((uint64_t(hash(uint32_t(index))) << 32) | hash(uint32_t(index) ^ 0x5bd1e995U));
+        nextUInt();
+    }
+
+    // next dimension of current sample, in [0, 1)
+    ELEMTYPE next() {
+        if (_type == HALTON && _dimension < MAXDIMENSION) {
+            // index 0 is skipped, it's 0 in all dimensions
+            ELEMTYPE u = radicalInverse(_dimension, _sampleIndex + 1) + _shift[_dimension];
+            ++_dimension;
+            return u >= 1? u - 1: u;
+        }
+        ++_dimension;
+        return uniform();
+    }
+};
+
+#endif /* SAMPLER_H */
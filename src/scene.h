@@ -11,82 +11,222 @@
  *  Description: This is scene class, 
  *               which includes all objects and light sources.
  *               providing all related functions.
+ *               Objects, lights, materials and textures are made in
+ *               the arena of the scene, and freed with it.
  *****************************************************************************/
 #ifndef SCENE_H
 #define SCENE_H
 
 #include "common.h"
 #include "octree.h"
+#include "bvh.h"
+#include "primitives.h"
+#include "raypacket.h"
 #include "object.h"
+#include "objects.h"
 #include "ray.h"
 #include "lightsource.h"
+#include "arena.h"
+#include "sampler.h"
 #include <vector>
 #include <algorithm>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
 
 using namespace RayTracing;
 
 class Scene {
+public:
+    enum ACCELERATOR_TYPE { LINEAR_SCAN = 0, OCTREE_ACCELERATOR = 1, BVH_ACCELERATOR = 2 };
+
+    // limits of paths, the defaults are those of common.h
+    struct PathBudget {
+        // bounces of secondary rays, a material may limit rays spawned on it further
+        COUNTTYPE maxDepth;
+        // rays weaker than this are dropped
+        ELEMTYPE minWeight;
+        // rays weaker than this go on with probability intensity / rouletteWeight,
+        // with their intensity raised to rouletteWeight, so the light expected of them 
+        // is kept. 0 to disable Russian roulette
+        ELEMTYPE rouletteWeight;
+        // secondary rays a pixel may spawn in all, over all its camera rays,
+        // 0 for no limit. of rays traced together, those of shallower bounces take it first
+        COUNTTYPE maxSecondaryRays;
+        PathBudget(): maxDepth(maxRecursionDepth), minWeight(ignoreWeight), 
+                      rouletteWeight(0), maxSecondaryRays(0) { }
+    };
+
+private:
+    Arena _arena;
     std::vector<LightSource*> lights;
-#ifdef OCTREE
-    Octree<Object, ELEMTYPE, COUNTTYPE, ELEMTYPE, 5> objects;
-#else
     std::vector<Object*> objects; 
-#endif
+    // objects, with each face of a mesh apart, as acceleration structures see them
+    std::vector<Primitive> primitiveList;
+    Octree<Primitive, ELEMTYPE, COUNTTYPE, ELEMTYPE, 5> octree;
+    BVH<Primitive, ELEMTYPE, COUNTTYPE, ELEMTYPE, 4> bvh;
+    // objects of each leaf of the acceleration structure, by leaf number,
+    // all objects are in leaf 0 with linear scan
+    PrimitiveStreams primitives;
+    std::vector<PrimitiveStreams::Range> leafPrimitives;
+    ACCELERATOR_TYPE _accelerator;
+    bool built;
+    PathBudget _budget;
 
-#ifdef OCTREE
-    const Object* findClosestObject(const Ray& ray, ELEMTYPE& minDistance, bool ignoreTransparentObj = 0) const {
-        minDistance = DOUBLE_MAX;
-        const Object* minDistanceObj = nullptr;
+    // returns false if ray intersects nothing, or fills hit of the closest object
+    bool findClosestHit(const Ray& ray, Hit& hit) const {
+        assert(built);
+        hit = Hit();
         
-        auto callBackFunction = [&](const Object* obj, ELEMTYPE& dist) -> bool {
-            ELEMTYPE distance = DOUBLE_MAX;
-            if (obj -> isIntersected(ray, distance) && !(ignoreTransparentObj && obj -> isTransparent())){
-                if (distance < minDistance) 
-                    minDistance = distance, minDistanceObj = obj;
-                dist = distance;
-                return 1;
-            }
-            else return 0;
+        PrimitiveStreams::RayLanes lanes(ray, primitives);
+        auto leafFunction = [&](const COUNTTYPE leaf, ELEMTYPE& closest) -> bool {
+            if (!primitives.intersect(leafPrimitives[leaf], lanes, hit)) return 0;
+            closest = hit.distance;
+            return 1;
         };
 
-        bool find = objects.search(ray.origin()[0], ray.origin()[1], ray.origin()[2], 
-                                   ray.direction()[0], ray.direction()[1], ray.direction()[2],
-                                   callBackFunction);
-        // assert(find == bool(minDistanceObj));
-        return minDistanceObj;
-    }
-
-#else
-    const Object* findClosestObject(const Ray& ray, ELEMTYPE& minDistance, bool ignoreTransparentObj = 0) const { 
-        minDistance = DOUBLE_MAX;
-        const Object* minDistanceObj = nullptr;
-        for_each(objects.begin(), objects.end(), [=, &minDistanceObj, &minDistance](const Object* const obj) {
-            ELEMTYPE distance = DOUBLE_MAX;
-            if (obj -> isIntersected(ray, distance) && distance < minDistance && !(ignoreTransparentObj && obj -> isTransparent())) {
-                minDistance = distance;
-                minDistanceObj = obj;
+        switch (_accelerator) {
+            case OCTREE_ACCELERATOR:
+                octree.searchLeaves(ray.origin()[0], ray.origin()[1], ray.origin()[2], 
+                                    ray.direction()[0], ray.direction()[1], ray.direction()[2],
+                                    leafFunction);
+                break;
+            case BVH_ACCELERATOR:
+                bvh.searchLeaves(ray.origin()[0], ray.origin()[1], ray.origin()[2], 
+                                 ray.direction()[0], ray.direction()[1], ray.direction()[2],
+                                 leafFunction);
+                break;
+            case LINEAR_SCAN:
+                primitives.intersect(leafPrimitives[0], lanes, hit);
+                break;
+            default:
+                assert(0); // should never happen
+        }
+        primitives.countTests(lanes);
+        if (!hit.object) return 0;
+        hit.object -> fillHit(ray, hit);
+        return 1;
+    }
+
+    template < class LEAFFUNC >
+    // func(leaf, rays) for each leaf that rays (a bit mask) of packet pass through
+    // before packet.closest, func may lower packet.closest
+    void searchPacket(RayPacket& packet, LEAFFUNC func) const {
+        assert(built);
+        switch (_accelerator) {
+            case OCTREE_ACCELERATOR: {
+                const ELEMTYPE* o[3] = { packet.origin(0), packet.origin(1), packet.origin(2) };
+                const ELEMTYPE* d[3] = { packet.direction(0), packet.direction(1), packet.direction(2) };
+                const ELEMTYPE* invD[3] = { packet.invDirection(0), packet.invDirection(1), packet.invDirection(2) };
+                octree.searchPacket(packet.size(), o, d, invD, packet.closest, func);
+                break;
             }
-        } );
-        return minDistanceObj;
+            case BVH_ACCELERATOR: {
+                auto hits = [&](const ELEMTYPE minBound[3], const ELEMTYPE maxBound[3], const unsigned rays) {
+                    return packet.entering(minBound, maxBound, rays);
+                };
+                bvh.searchPacket(packet.direction(0)[0], packet.direction(1)[0], packet.direction(2)[0], 
+                                 packet.all(), hits, func);
+                break;
+            }
+            case LINEAR_SCAN:
+                func(0, packet.all());
+                break;
+            default:
+                assert(0); // should never happen
+        }
     }
-#endif
-    Color phong(const Ray& ray, const ELEMTYPE distance, const Object* obj) const { 
+
+    // closest hits of rays traced together, 
+    // sets packet.hits and packet.closest
+    void findClosestHits(RayPacket& packet) const {
+        searchPacket(packet, [&](const COUNTTYPE leaf, const unsigned rays) {
+            for (COUNTTYPE r = 0; r < packet.size(); ++r)
+                if ((rays >> r & 1) && primitives.intersect(leafPrimitives[leaf], packet.lanes[r], packet.hits[r]))
+                    packet.closest[r] = packet.hits[r].distance;
+        });
+        // rays of a packet share a mailbox
+        primitives.countTests(packet.lanes[0]);
+        for (COUNTTYPE r = 0; r < packet.size(); ++r)
+            if (packet.hits[r].object) 
+                packet.hits[r].object -> fillHit(*packet.lanes[r].ray, packet.hits[r]);
+    }
+
+    // returns true if any opaque object is intersected by the ray within distance tMax
+    bool occluded(const Ray& ray, const ELEMTYPE tMax) const {
+        assert(built);
+        PrimitiveStreams::RayLanes lanes(ray, primitives);
+        auto leafFunction = [&](const COUNTTYPE leaf) -> bool {
+            return primitives.occluded(leafPrimitives[leaf], lanes, tMax);
+        };
+
+        bool blocked = 0;
+        switch (_accelerator) {
+            case OCTREE_ACCELERATOR:
+                blocked = octree.occludedLeaves(ray.origin()[0], ray.origin()[1], ray.origin()[2], 
+                                                ray.direction()[0], ray.direction()[1], ray.direction()[2],
+                                                tMax, leafFunction);
+                break;
+            case BVH_ACCELERATOR:
+                blocked = bvh.occludedLeaves(ray.origin()[0], ray.origin()[1], ray.origin()[2], 
+                                             ray.direction()[0], ray.direction()[1], ray.direction()[2],
+                                             tMax, leafFunction);
+                break;
+            case LINEAR_SCAN:
+                blocked = leafFunction(0);
+                break;
+            default:
+                assert(0); // should never happen
+        }
+        primitives.countTests(lanes);
+        return blocked;
+    }
+
+    // ray from light to hit, blocked by objects intersected within distance tMax.
+    // it ends at hit.offset on the side of the light, off the surface hit and
+    // short of the walls meeting it at a corner
+    static Ray shadowRay(const LightSource* light, const Hit& hit, ELEMTYPE& tMax) {
+        Vector toLight = (light -> position() - hit.point).normalize();
+        Point p = hit.offset(toLight, toLight);
+        tMax = (p - light -> position()).norm();
+        return Ray(light -> position(), p - light -> position());
+    }
+
+    // bit r is set if ray r of packet is blocked by any opaque object within
+    // distance packet.closest[r], such as shadow rays from a light
+    unsigned occluded(RayPacket& packet) const {
+        unsigned blocked = 0;
+        // a blocked ray goes no further
+        searchPacket(packet, [&](const COUNTTYPE leaf, const unsigned rays) {
+            for (COUNTTYPE r = 0; r < packet.size(); ++r)
+                if ((rays >> r & 1) && primitives.occluded(leafPrimitives[leaf], packet.lanes[r], packet.closest[r])) {
+                    blocked |= 1u << r;
+                    packet.closest[r] = -1;
+                }
+        });
+        primitives.countTests(packet.lanes[0]);
+        return blocked;
+    }
+
+    template < class BLOCKEDFUNC >
+    // blocked(k) returns true if light k is blocked on its way to hit
+    Color phong(const Ray& ray, const Hit& hit, BLOCKEDFUNC blocked) const { 
+        const Material& material = primitives.material(hit.material);
         Color rtvColor(0, 0, 0);
         // lambert diffuse reflection
-        rtvColor += Color(whiteColor, obj -> diffuseReflectivity());
+        rtvColor += Color(whiteColor, material.diffuseReflectivity());
         
-        Point reflectPoint = ray.origin() + distance * ray.direction();
-        Vector reflectPointNorm = obj -> normal(reflectPoint); 
+        const Point& reflectPoint = hit.point;
+        const Vector& reflectPointNorm = hit.normal; 
         Vector view = ELEMTYPE(-1.0) * ray.direction();
         // specular reflection
-        for (auto ite: lights) {
+        for (size_t k = 0; k < lights.size(); ++k) {
+            const LightSource* ite = lights[k];
             Vector incidentLight = (reflectPoint - ite -> position()).normalize();
 
-            ELEMTYPE blockObjDistance;
             // blocked by other objects
-            const Object* blockObj = findClosestObject(Ray(ite -> position(), incidentLight), blockObjDistance, 1);
-            if (blockObj && 
-                blockObjDistance < (reflectPoint - ite -> position()).norm() - EPSILON) {
+            if (blocked(k)) {
                 rtvColor += Color(0, 0, 0, shadowDarkness);
                 continue;
             }
@@ -96,31 +236,34 @@ class Scene {
             
             ELEMTYPE rCv = reflectedLight * view; // cross product of direciton of reflected light and direction of view
             if (rCv >= 0) 
-                rtvColor += Color(whiteColor, obj -> specularReflectivity() * 
-                                              pow(rCv, obj -> shininess()) / 
+                rtvColor += Color(whiteColor, material.specularReflectivity() * 
+                                              pow(rCv, material.shininess()) / 
                                               std::abs(reflectPointNorm * incidentLight));
 
         }
         return rtvColor;
     }
     
-    Ray getReflectedRay(const Ray& ray, const ELEMTYPE distance, const Object* obj) const {
-        Point reflectPoint = ray.origin() + ray.direction() * (distance - EPSILON); 
+    Ray getReflectedRay(const Ray& ray, const Hit& hit) const {
+        const Material& material = primitives.material(hit.material);
         Vector incidentLight = ray.direction();
-        Vector reflectPointNorm = obj -> normal(reflectPoint);
+        Vector reflectPointNorm = hit.normal;
         if (reflectPointNorm * incidentLight > 0)
             reflectPointNorm *= -1;
         assert(reflectPointNorm * incidentLight < 0);
         Vector reflectedLight = incidentLight - 2 * (incidentLight * reflectPointNorm) * reflectPointNorm;
         
-        return Ray(reflectPoint, 
-                   reflectedLight, 
-                   ray.refractiveIndex(), 
-                   ray.intensity() * obj -> reflectionWeight());
+        Ray reflectedRay(hit.offset(reflectedLight, ELEMTYPE(-1) * incidentLight), 
+                         reflectedLight, 
+                         ray.refractiveIndex(), 
+                         ray.intensity() * material.reflectionWeight());
+        // the cone goes on from where it met the surface, curvature is ignored
+        reflectedRay.setCone(ray.footprint(hit.distance), ray.spread());
+        return reflectedRay;
 
     }
     
-    Ray getRefractedRay(const Ray& ray, const ELEMTYPE distance, const Object* obj) const {
+    Ray getRefractedRay(const Ray& ray, const Hit& hit) const {
         // algorithm:
         // n: normal, points to refraction point
         // l: incident light
@@ -129,11 +272,11 @@ class Scene {
         // cos(theta1) = n * l
         // cos(theta2) = sqrt(1 - (1 - (cos^2(theta1)) / eta ^ 2)
         // t = l / eta + (cos(theta1) / eta - cos(theta2)) * n
-        Point refractPoint = ray.origin() + ray.direction() * (distance + EPSILON);
+        const Material& material = primitives.material(hit.material);
         Vector incidentLight = ray.direction();
-        Vector refractPointNorm = obj -> normal(refractPoint);
+        Vector refractPointNorm = hit.normal;
         ELEMTYPE cosIncidentAngle = refractPointNorm * incidentLight;
-        ELEMTYPE objRefractiveIndex = obj -> refractiveIndex();
+        ELEMTYPE objRefractiveIndex = material.refractiveIndex();
         if (cosIncidentAngle < 0) {
             cosIncidentAngle *= -1;
             refractPointNorm *= -1;
@@ -143,8 +286,8 @@ class Scene {
         ELEMTYPE cosRefractionAngle = 1 - (1 - pow(cosIncidentAngle, 2)) / pow(relativeRefractiveIndex, 2);
 
         if (cosRefractionAngle < 0) { // total reflection
-            Ray reflectedRay = getReflectedRay(ray, distance, obj);
-            reflectedRay.setIntensity(ray.intensity() * obj -> refractionWeight());
+            Ray reflectedRay = getReflectedRay(ray, hit);
+            reflectedRay.setIntensity(ray.intensity() * material.refractionWeight());
             return reflectedRay;
         }
 
@@ -154,57 +297,421 @@ class Scene {
                                   (cosIncidentAngle / relativeRefractiveIndex - cosRefractionAngle) * refractPointNorm; 
 
         assert(std::abs(refractDirection.norm() - 1) < EPSILON); 
-        Ray refractedRay(refractPoint, 
+        Ray refractedRay(hit.offset(refractDirection, incidentLight), 
                          refractDirection, 
                          objRefractiveIndex, 
-                         ray.intensity() * obj -> refractionWeight());
+                         ray.intensity() * material.refractionWeight());
+        refractedRay.setCone(ray.footprint(hit.distance), ray.spread());
         return refractedRay;
     }
     
+    // lists objects in order, faces of a mesh in place of it
+    void listPrimitives() {
+        primitiveList.clear();
+        for (auto obj: objects) {
+            if (obj -> type() != Object::MESH) primitiveList.push_back(Primitive(obj, 0));
+            else for (COUNTTYPE f = 0; f < static_cast<const TriangleMesh*>(obj) -> faceCount(); ++f)
+                primitiveList.push_back(Primitive(obj, f));
+        }
+    }
 
 public:
 #ifdef OCTREE
-    // TODO: the range need changing if coordinate of objects are changed
-    Scene(): objects(-10000, -10000, -10000, 10000, 10000, 10000) { }
-    void insert(Object* obj) { 
-        objects.insert(obj); 
-    }
+    Scene(): _accelerator(OCTREE_ACCELERATOR), built(0) { }
 #else 
-    Scene() { }
-    void insert(Object* obj) { objects.push_back(obj); }
+    Scene(): _accelerator(LINEAR_SCAN), built(0) { }
 #endif
 
+    // where objects, lights, materials and textures inserted are made, 
+    // they live until the scene is cleared or destroyed
+    Arena& arena() { return _arena; }
+    void insert(Object* obj) { objects.push_back(obj); built = 0; }
+    COUNTTYPE objectCount() const { return objects.size(); }
+    const Object* object(const COUNTTYPE i) const { return objects[i]; }
+    COUNTTYPE lightCount() const { return lights.size(); }
+    // primitives are listed by build() or load()
+    COUNTTYPE primitiveCount() const { return primitiveList.size(); }
+    const Primitive* primitive(const COUNTTYPE i) const { return &primitiveList[i]; }
+    COUNTTYPE primitiveIndex(const Primitive* p) const { return p - primitiveList.data(); }
+    const LightSource* light(const COUNTTYPE i) const { return lights[i]; }
+
+    // acceleration structure is chosen at run time,
+    // build() must be called after changing it
+    void setAccelerator(const ACCELERATOR_TYPE a) { 
+        if (a != _accelerator) built = 0;
+        _accelerator = a; 
+    }
+    ACCELERATOR_TYPE accelerator() const { return _accelerator; }
+    void setOctreeMaxDepth(const COUNTTYPE d) { 
+        if (d != octree.maxDepth() && _accelerator == OCTREE_ACCELERATOR) built = 0;
+        octree.setMaxDepth(d); 
+    }
+    bool isBuilt() const { return built; }
+
+    // statistics of the built acceleration structure
+    COUNTTYPE acceleratorNodeCount() const {
+        switch (_accelerator) {
+            case OCTREE_ACCELERATOR: return octree.nodeCount();
+            case BVH_ACCELERATOR: return bvh.nodeCount();
+            default: return 0;
+        }
+    }
+    // primitives tested by all rays, with any accelerator. a primitive in several
+    // leaves is tested once a ray, the tests skipped are duplicate tests avoided
+    unsigned long long objectTests() const { return primitives.objectTests(); }
+    unsigned long long duplicateTestsAvoided() const { return primitives.duplicateTestsAvoided(); }
+    COUNTTYPE acceleratorDepth() const {
+        switch (_accelerator) {
+            case OCTREE_ACCELERATOR: return octree.depth();
+            case BVH_ACCELERATOR: return bvh.depth();
+            default: return 0;
+        }
+    }
+
+    // must be called after all objects are inserted and before ray tracing
+    void build() {
+        octree.clear();
+        bvh.clear();
+        primitives.clear();
+        leafPrimitives.clear();
+        listPrimitives();
+        auto leafFunction = [&](const COUNTTYPE leaf, const Primitive* const* prims, const COUNTTYPE count) {
+            leafPrimitives[leaf] = primitives.insert(prims, count);
+        };
+        switch (_accelerator) {
+            case OCTREE_ACCELERATOR:
+                for (auto& p: primitiveList) octree.insert(&p);
+                octree.build();
+                leafPrimitives.resize(octree.nodeCount());
+                octree.forEachLeaf(leafFunction);
+                break;
+            case BVH_ACCELERATOR:
+                for (auto& p: primitiveList) bvh.insert(&p);
+                bvh.build();
+                leafPrimitives.resize(bvh.nodeCount());
+                bvh.forEachLeaf(leafFunction);
+                break;
+            case LINEAR_SCAN: {
+                std::vector<const Primitive*> all;
+                for (auto& p: primitiveList) all.push_back(&p);
+                leafPrimitives.push_back(primitives.insert(all.data(), all.size()));
+                break;
+            }
+            default:
+                assert(0); // should never happen
+        }
+        built = 1;
+    }
+
+    template < class WRITER >
+    // writes what build() makes, objects are written as numbers given by out
+    void save(WRITER& out) const {
+        assert(built);
+        out.write(_accelerator);
+        switch (_accelerator) {
+            case OCTREE_ACCELERATOR: octree.save(out); break;
+            case BVH_ACCELERATOR: bvh.save(out); break;
+            default: break;
+        }
+        primitives.save(out);
+        out.write(leafPrimitives);
+    }
+
+    template < class READER >
+    // reads what save wrote in place of build(), after all objects are inserted
+    // in the same order. objects are taken from in by their numbers
+    void load(READER& in) {
+        octree.clear();
+        bvh.clear();
+        listPrimitives();
+        std::underlying_type<ACCELERATOR_TYPE>::type accelerator;
+        in.read(accelerator);
+        // leaves are numbered as nodes
+        size_t leafCount = 1;
+        switch (accelerator) {
+            case OCTREE_ACCELERATOR: octree.load(in); leafCount = octree.nodeCount(); break;
+            case BVH_ACCELERATOR: bvh.load(in); leafCount = bvh.nodeCount(); break;
+            case LINEAR_SCAN: break;
+            default: in.check(0); return;
+        }
+        _accelerator = ACCELERATOR_TYPE(accelerator);
+        primitives.load(in);
+        in.read(leafPrimitives);
+        in.check(leafPrimitives.size() == leafCount);
+        for (auto& range: leafPrimitives) if (!in.check(primitives.contains(range))) break;
+        built = in.good();
+    }
+
+    // removes everything and frees it at once, the scene is empty as a new one
+    void clear() {
+        octree.clear();
+        bvh.clear();
+        primitives.clear();
+        leafPrimitives.clear();
+        primitiveList.clear();
+        objects.clear();
+        lights.clear();
+        _arena.clear();
+        built = 0;
+    }
+
     ~Scene() { }
     void insert(LightSource* l) { lights.push_back(l); }
 
-    void rayTrace(const Ray& ray, Color& color, 
-                  const COUNTTYPE recursionDepth = 0) const {
-        if (recursionDepth > maxRecursionDepth) return;
-        // the light is too weak
-        if (ray.intensity() < ignoreWeight) return;
-
-        // find the closest object
-        ELEMTYPE objDistance;
-        const Object* closestObj = findClosestObject(ray, objDistance);
-        // if not found
-        if (!closestObj) return;
-        
-        // if found
-        // ambient occlusion
-        color += Color(closestObj -> texture(ray.origin() + objDistance * ray.direction()), 
-                       ray.intensity() * closestObj -> ambientCoefficient());
-        // local illumination model
-        color += Color(phong(ray, objDistance, closestObj), ray.intensity());
-        
-        // calculate reflect ray and refract ray recursive trace
-        if (closestObj -> reflectionWeight()) {
-            Ray reflectedRay = getReflectedRay(ray, objDistance, closestObj);
-            if (reflectedRay.intensity()) rayTrace(reflectedRay, color, recursionDepth + 1);
+    // storage of the stages of tracing, kept by the caller so it's reused
+    class Wavefront {
+    public:
+        // secondary rays not traced for the budget, counted over all rays traced with the wavefront
+        struct Pruned {
+            // beyond max depth of the scene or material
+            unsigned long long depth;
+            // weaker than min weight
+            unsigned long long weight;
+            // lost in Russian roulette
+            unsigned long long roulette;
+            // over the secondary rays of their pixel
+            unsigned long long budget;
+            Pruned(): depth(0), weight(0), roulette(0), budget(0) { }
+        };
+        const Pruned& pruned() const { return _pruned; }
+
+    private:
+        friend class Scene;
+        // a ray of a path, its color is mixed into colors[target], and rays it spawns
+        // are counted for pixel. the weight of the path so far is the intensity of the ray,
+        // random numbers of the path are drawn from seed
+        struct PathRay {
+            Ray ray;
+            COUNTTYPE target;
+            COUNTTYPE pixel;
+            COUNTTYPE depth;
+            uint32_t seed;
+            PathRay(const Ray& r, const COUNTTYPE t, const COUNTTYPE p, const COUNTTYPE d, const uint32_t s): 
+                ray(r), target(t), pixel(p), depth(d), seed(s) { }
+        };
+        // rays of the current bounce, and rays they spawn for the next one
+        std::vector<PathRay> rays, spawned;
+        // hits of rays, rays hitting nothing are dropped after intersection
+        std::vector<Hit> hits;
+        // light k is blocked on its way to hit i if blocked[i * lightCount() + k] is set
+        std::vector<unsigned char> blocked;
+        // rays of a packet
+        std::vector<Ray> packet;
+        // sort keys of spawned rays with their places, and spawned rays in order of keys
+        std::vector< std::pair<uint64_t, uint32_t> > keys;
+        std::vector<PathRay> sorted;
+        Pruned _pruned;
+    };
+
+    void setPathBudget(const PathBudget& budget) {
+        assert(budget.maxDepth >= 0 && budget.minWeight >= 0 && 
+               budget.rouletteWeight >= 0 && budget.maxSecondaryRays >= 0);
+        _budget = budget;
+    }
+    const PathBudget& pathBudget() const { return _budget; }
+
+    // traces rays through the scene bounce by bounce, rays of a bounce pass stage by stage:
+    // intersection, shadow rays from each light, shading and spawning secondary rays.
+    // every stage runs over all rays in packets of packetSize, 1 to trace rays one by one.
+    // if sortSecondary is set, secondary rays are sorted so that nearby rays go about together.
+    // rays[i] is a ray of pixel pixels[i], secondary rays it spawns are added to
+    // secondaryRays[pixels[i]] for the budget of the pixel. the caller keeps the counts
+    // over all rays of a pixel, if they're traced in more than one call
+    void rayTrace(const std::vector<Ray>& rays, const std::vector<COUNTTYPE>& pixels,
+                  std::vector<COUNTTYPE>& secondaryRays, std::vector<Color>& colors, Wavefront& wavefront,
+                  const COUNTTYPE packetSize = RayPacket::MAXSIZE, const bool sortSecondary = 0) const {
+        assert(packetSize > 0 && packetSize <= RayPacket::MAXSIZE);
+        assert(pixels.size() == rays.size());
+        colors.assign(rays.size(), Color(0, 0, 0, 0));
+        wavefront.rays.clear();
+        for (size_t i = 0; i < rays.size(); ++i) {
+            assert(pixels[i] >= 0 && pixels[i] < COUNTTYPE(secondaryRays.size()));
+            // the light is too weak
+            if (rays[i].intensity() >= _budget.minWeight) 
+                wavefront.rays.push_back(Wavefront::PathRay(rays[i], i, pixels[i], 0, pathSeed(rays[i])));
+        }
+
+        while (wavefront.rays.size()) {
+            intersect(wavefront, packetSize);
+            traceShadows(wavefront, packetSize);
+            shade(wavefront, colors);
+            spawn(wavefront, secondaryRays);
+            if (sortSecondary) sortSpawned(wavefront);
+            std::swap(wavefront.rays, wavefront.spawned);
+        }
+    }
+
+private:
+    // finds hits of rays in the queue and drops those hitting nothing
+    void intersect(Wavefront& w, const COUNTTYPE packetSize) const {
+        w.hits.resize(w.rays.size());
+        for (size_t first = 0; first < w.rays.size(); first += packetSize) {
+            size_t count = std::min(w.rays.size() - first, size_t(packetSize));
+            if (count == 1) {
+                findClosestHit(w.rays[first].ray, w.hits[first]);
+                continue;
+            }
+            w.packet.clear();
+            for (size_t i = first; i < first + count; ++i) w.packet.push_back(w.rays[i].ray);
+            RayPacket packet(w.packet, primitives);
+            findClosestHits(packet);
+            std::copy(packet.hits, packet.hits + count, w.hits.begin() + first);
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < w.rays.size(); ++i) {
+            if (!w.hits[i].object) continue;
+            w.rays[kept] = w.rays[i];
+            w.hits[kept++] = w.hits[i];
         }
-        if (closestObj -> refractionWeight()) {
-            Ray refractedRay = getRefractedRay(ray, objDistance, closestObj);
-            if (refractedRay.intensity()) rayTrace(refractedRay, color, recursionDepth + 1);
+        w.rays.erase(w.rays.begin() + kept, w.rays.end());
+        w.hits.resize(kept);
+    }
+
+    // shadow rays from each light to all hits, those of a light go about the same way
+    void traceShadows(Wavefront& w, const COUNTTYPE packetSize) const {
+        const size_t lightCount = lights.size();
+        w.blocked.assign(w.hits.size() * lightCount, 0);
+        ELEMTYPE tMax[RayPacket::MAXSIZE];
+        for (size_t k = 0; k < lightCount; ++k) {
+            for (size_t first = 0; first < w.hits.size(); first += packetSize) {
+                size_t count = std::min(w.hits.size() - first, size_t(packetSize));
+                w.packet.clear();
+                for (size_t i = first; i < first + count; ++i)
+                    w.packet.push_back(shadowRay(lights[k], w.hits[i], tMax[i - first]));
+                if (count == 1) {
+                    w.blocked[first * lightCount + k] = occluded(w.packet[0], tMax[0]);
+                    continue;
+                }
+                RayPacket packet(w.packet, primitives);
+                for (size_t i = 0; i < count; ++i) packet.closest[i] = tMax[i];
+                unsigned blocked = occluded(packet);
+                for (size_t i = 0; i < count; ++i) 
+                    w.blocked[(first + i) * lightCount + k] = blocked >> i & 1;
+            }
+        }
+    }
+
+    // mixes the light each hit reflects to its ray into the color of the path
+    void shade(const Wavefront& w, std::vector<Color>& colors) const {
+        for (size_t i = 0; i < w.hits.size(); ++i) {
+            const unsigned char* blocked = w.blocked.data() + i * lights.size();
+            shade(w.rays[i].ray, w.hits[i], colors[w.rays[i].target], 
+                  [&](const size_t k) -> bool { return blocked[k]; });
+        }
+    }
+
+    // seed of random numbers of the path of a camera ray, taken from its direction
+    // so that paths of all pixels and rays have seeds of their own
+    static uint32_t pathSeed(const Ray& ray) {
+        uint32_t seed = 0;
+        for (COUNTTYPE k = 0; k < 3; ++k) {
+            ELEMTYPE d = ray.direction()[k];
+            uint64_t bits = 0;
+            std::memcpy(&bits, &d, sizeof(d));
+            seed = Sampler::hash(seed ^ uint32_t(bits) ^ uint32_t(bits >> 32));
         }
+        return seed;
+    }
+
+    // queues ray spawned by path, branch 0 is reflected and 1 refracted,
+    // unless the budget prunes it
+    void spawn(Wavefront& w, const Wavefront::PathRay& path, Ray& ray, const COUNTTYPE branch,
+               std::vector<COUNTTYPE>& secondaryRays) const {
+        if (ray.intensity() < _budget.minWeight) {
+            ++w._pruned.weight;
+            return;
+        }
+        uint32_t seed = Sampler::hash(path.seed + branch + 1);
+        if (ray.intensity() < _budget.rouletteWeight) {
+            // 24 bits so the number is below 1 in single precision too
+            ELEMTYPE u = ELEMTYPE(seed >> 8) * (ELEMTYPE(1) / (1 << 24));
+            if (u * _budget.rouletteWeight >= ray.intensity()) {
+                ++w._pruned.roulette;
+                return;
+            }
+            ray.setIntensity(_budget.rouletteWeight);
+        }
+        if (_budget.maxSecondaryRays) {
+            if (secondaryRays[path.pixel] >= _budget.maxSecondaryRays) {
+                ++w._pruned.budget;
+                return;
+            }
+            ++secondaryRays[path.pixel];
+        }
+        w.spawned.push_back(Wavefront::PathRay(ray, path.target, path.pixel, path.depth + 1, seed));
+    }
+
+    // reflected and refracted rays of hits, for the next bounce
+    void spawn(Wavefront& w, std::vector<COUNTTYPE>& secondaryRays) const {
+        w.spawned.clear();
+        for (size_t i = 0; i < w.hits.size(); ++i) {
+            const Wavefront::PathRay& path = w.rays[i];
+            const Material& material = primitives.material(w.hits[i].material);
+            COUNTTYPE maxDepth = _budget.maxDepth;
+            if (material.maxDepth() >= 0) maxDepth = std::min(maxDepth, material.maxDepth());
+            if (path.depth >= maxDepth) {
+                w._pruned.depth += (material.reflectionWeight() != 0) + (material.refractionWeight() != 0);
+                continue;
+            }
+            if (material.reflectionWeight()) {
+                Ray reflectedRay = getReflectedRay(path.ray, w.hits[i]);
+                spawn(w, path, reflectedRay, 0, secondaryRays);
+            }
+            if (material.refractionWeight()) {
+                Ray refractedRay = getRefractedRay(path.ray, w.hits[i]);
+                spawn(w, path, refractedRay, 1, secondaryRays);
+            }
+        }
+    }
+
+    // orders spawned rays by the octant of their directions, then by the Morton code of
+    // their origins in the box of all origins, so that rays traced one after another,
+    // and rays of a packet, start from the same cells and go the same way
+    void sortSpawned(Wavefront& w) const {
+        if (w.spawned.size() < 2) return;
+        constexpr COUNTTYPE BITS = 10;
+        Point lower = w.spawned[0].ray.origin(), upper = lower;
+        for (const Wavefront::PathRay& path: w.spawned) {
+            const Point o = path.ray.origin();
+            for (COUNTTYPE k = 0; k < 3; ++k) {
+                lower[k] = std::min(lower[k], o[k]);
+                upper[k] = std::max(upper[k], o[k]);
+            }
+        }
+        ELEMTYPE scale[3];
+        for (COUNTTYPE k = 0; k < 3; ++k) 
+            scale[k] = upper[k] > lower[k]? ((1 << BITS) - 1) / (upper[k] - lower[k]): 0;
+
+        w.keys.clear();
+        for (size_t i = 0; i < w.spawned.size(); ++i) {
+            const Point o = w.spawned[i].ray.origin();
+            const Vector d = w.spawned[i].ray.direction();
+            uint64_t key = 0;
+            for (COUNTTYPE k = 0; k < 3; ++k) key |= uint64_t(d[k] < 0) << (3 * BITS + k);
+            for (COUNTTYPE k = 0; k < 3; ++k) {
+                uint32_t cell = uint32_t((o[k] - lower[k]) * scale[k]);
+                for (COUNTTYPE bit = 0; bit < BITS; ++bit) key |= uint64_t(cell >> bit & 1) << (3 * bit + k);
+            }
+            w.keys.push_back(std::make_pair(key, uint32_t(i)));
+        }
+        // places break ties, so the order doesn't depend on the sort
+        std::sort(w.keys.begin(), w.keys.end());
+        w.sorted.clear();
+        for (auto& key: w.keys) w.sorted.push_back(w.spawned[key.second]);
+        std::swap(w.spawned, w.sorted);
+    }
+
+    template < class BLOCKEDFUNC >
+    // light of ray hitting an object, secondary rays aren't traced here.
+    // blocked(k) returns true if light k is blocked on its way to hit
+    void shade(const Ray& ray, const Hit& hit, Color& color, BLOCKEDFUNC blocked) const {
+        const Material& material = primitives.material(hit.material);
+        // ambient occlusion
+        color += Color(hit.object -> texture(hit), 
+                       ray.intensity() * material.ambientCoefficient());
+        // local illumination model
+        color += Color(phong(ray, hit, blocked), ray.intensity());
     }
 };
 
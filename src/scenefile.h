@@ -0,0 +1,469 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: scenefile.h
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 23:41:19
+ *  Description: Compiled scene. A scene, its materials, decoded textures
+ *               and built acceleration structure are written to one binary
+ *               file, which is mapped into memory and read back without
+ *               parsing, decoding or building anything.
+ *****************************************************************************/
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <unordered_map>
+#include <type_traits>
+#include "common.h"
+#include "mappedfile.h"
+#include "simd.h"
+#include "scene.h"
+#include "objects.h"
+#include "lightsource.h"
+#include "material.h"
+#include "texture.h"
+
+using namespace RayTracing;
+
+class SceneFile {
+    // a compiled scene starts with MAGIC and VERSION, followed by the sizes of
+    // types it was written with. files of other versions or sizes are refused,
+    // compile the scene again. VERSION changes with the layout of anything written
+    constexpr static unsigned VERSION = 3;
+    static const char* magic() { return "RTSCENE"; }
+    constexpr static size_t MAGICSIZE = 8;
+
+    // values are written as their bytes, vectors of them after their size.
+    // objects and primitives are written as their index in the scene, -1 for none
+    class Writer {
+        std::ofstream fout;
+        std::unordered_map<const Object*, COUNTTYPE> objectIds;
+        const Scene& scene;
+
+    public:
+        // writes nothing if the file can't be opened, good() tells
+        Writer(const std::string& filename, const Scene& s):
+            fout(filename.c_str(), std::ios::binary), scene(s) {
+            for (COUNTTYPE i = 0; i < scene.objectCount(); ++i) objectIds[scene.object(i)] = i;
+        }
+
+        template < class T >
+        void write(const T& value) {
+            static_assert(std::is_trivially_copyable<T>::value, "written as bytes");
+            fout.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        template < class T >
+        void write(const std::vector<T>& values) {
+            static_assert(std::is_trivially_copyable<T>::value, "written as bytes");
+            write(uint64_t(values.size()));
+            fout.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+        }
+
+        void object(const Object* obj) { write(obj? objectIds.at(obj): COUNTTYPE(-1)); }
+        void object(const Primitive* p) { write(scene.primitiveIndex(p)); }
+
+        bool good() const { return fout.good(); }
+        // returns false if anything failed to be written
+        bool close() {
+            fout.close();
+            return !fout.fail();
+        }
+    };
+
+    // reads what Writer wrote from the file mapped into memory.
+    // what's read is checked, by check() in the loaders of other classes too.
+    // after a failed check or a read past the end, error() tells why, reads give
+    // zeros, empty vectors and null objects, and loaders stop as soon as they can
+    class Reader {
+        MappedFile file;
+        const char* data;
+        size_t size;
+        size_t position;
+        std::string _error;
+        const std::vector<Object*>& objects;
+        const Scene& scene;
+
+    public:
+        Reader(const std::string& filename, const std::vector<Object*>& objs, 
+               const Scene& s):
+            file(filename), data(file.data()), size(file.size()), position(0), objects(objs), scene(s) {
+            if (!file.good()) fail("can't open");
+        }
+
+        // nothing more is read, the first message is kept
+        void fail(const std::string& message) {
+            if (_error.empty()) _error = message;
+            position = size;
+        }
+        // the file is corrupted if condition is false.
+        // returns false then, or if reading failed already
+        bool check(const bool condition) {
+            if (!condition) fail("corrupted");
+            return condition && good();
+        }
+        bool good() const { return _error.empty(); }
+        const std::string& error() const { return _error; }
+
+        template < class T >
+        void read(T& value) {
+            static_assert(std::is_trivially_copyable<T>::value, "read as bytes");
+            if (size - position < sizeof(T)) {
+                fail("truncated");
+                memset(static_cast<void*>(&value), 0, sizeof(T));
+                return;
+            }
+            memcpy(static_cast<void*>(&value), data + position, sizeof(T));
+            position += sizeof(T);
+        }
+
+        template < class T >
+        void read(std::vector<T>& values) {
+            static_assert(std::is_trivially_copyable<T>::value, "read as bytes");
+            uint64_t count;
+            read(count);
+            values.clear();
+            if (count > (size - position) / sizeof(T)) return fail("truncated");
+            values.resize(count);
+            if (count) memcpy(static_cast<void*>(values.data()), data + position, count * sizeof(T));
+            position += count * sizeof(T);
+        }
+
+        template < class T >
+        // a number of things each written in at least a byte
+        void readCount(T& count) {
+            read(count);
+            check(count >= 0 && uint64_t(count) <= size - position);
+        }
+
+        void object(const Object*& obj) {
+            COUNTTYPE id;
+            read(id);
+            obj = check(id >= -1 && id < COUNTTYPE(objects.size())) && id >= 0? objects[id]: nullptr;
+        }
+
+        void object(const Primitive*& p) {
+            COUNTTYPE id;
+            read(id);
+            p = check(id >= 0 && id < scene.primitiveCount())? scene.primitive(id): nullptr;
+        }
+
+        // nullptr if there are fewer bytes left
+        const char* bytes(const size_t count) {
+            if (size - position < count) {
+                fail("truncated");
+                return nullptr;
+            }
+            position += count;
+            return data + position - count;
+        }
+
+        // bytes not read yet
+        size_t left() const { return size - position; }
+        bool end() const { return position == size; }
+    };
+
+    // what's read so far, by the numbers it's written as
+    std::vector< std::shared_ptr<Picture> > pictures;
+    std::vector<Texture*> textures;
+    std::vector<Material*> materials;
+    std::vector< std::shared_ptr< const std::vector<Point> > > meshVertices;
+    std::vector<Object*> objects;
+    std::string _error;
+
+    // material and texture of an object by their numbers, false if there are none such
+    bool readMaterial(Reader& in, const Material*& material, const Texture*& texture) {
+        COUNTTYPE materialId, textureId;
+        in.read(materialId);
+        in.read(textureId);
+        if (!in.check(materialId >= 0 && materialId < COUNTTYPE(materials.size()) &&
+                      textureId >= -1 && textureId < COUNTTYPE(textures.size()))) return 0;
+        material = materials[materialId];
+        texture = textureId < 0? nullptr: textures[textureId];
+        return 1;
+    }
+
+    // a mesh written by save, after its type. nullptr if it's corrupted
+    TriangleMesh* loadMesh(Reader& in, Scene& scene) {
+        COUNTTYPE count, id;
+        in.readCount(count);
+        std::vector< std::pair<const Material*, const Texture*> > table;
+        for (COUNTTYPE i = 0; i < count && in.good(); ++i) {
+            table.push_back(std::make_pair(nullptr, nullptr));
+            readMaterial(in, table.back().first, table.back().second);
+        }
+        in.read(id);
+        if (!in.check(id >= 0 && id < COUNTTYPE(meshVertices.size()))) return nullptr;
+        TriangleMesh* mesh = scene.arena().create<TriangleMesh>(meshVertices[id]);
+        for (auto& entry: table) mesh -> addMaterial(entry.first, entry.second);
+        if (!in.check(mesh -> tableSize() == count)) return nullptr;
+        in.readCount(count);
+        const size_t vertexCount = meshVertices[id] -> size();
+        for (COUNTTYPE f = 0; f < count && in.good(); ++f) {
+            TriangleMesh::Face face;
+            in.read(face);
+            bool valid = face.material < uint32_t(mesh -> tableSize());
+            COUNTTYPE corners = face.vertices[3] == TriangleMesh::NOVERTEX? 3: 4;
+            for (COUNTTYPE k = 0; k < corners; ++k) valid = valid && face.vertices[k] < vertexCount;
+            if (in.check(valid)) mesh -> addFace(face);
+        }
+        return in.good()? mesh: nullptr;
+    }
+
+    template < class T >
+    // index of p among those met before, it's added if new
+    static COUNTTYPE index(const T* p, std::unordered_map<const T*, COUNTTYPE>& ids, std::vector<const T*>& all) {
+        if (!p) return -1;
+        auto ite = ids.find(p);
+        if (ite != ids.end()) return ite -> second;
+        all.push_back(p);
+        return ids[p] = all.size() - 1;
+    }
+
+public:
+    // true if filename is a compiled scene
+    static bool isCompiled(const std::string& filename) {
+        std::ifstream fin(filename.c_str(), std::ios::binary);
+        char header[MAGICSIZE] = { 0 };
+        fin.read(header, MAGICSIZE);
+        return fin.good() && !memcmp(header, magic(), MAGICSIZE);
+    }
+
+    // writes the built scene with everything it refers to, textures must have
+    // been decoded. returns false if it can't be written, what's written then
+    // is refused as truncated
+    static bool save(const std::string& filename, const Scene& scene) {
+        assert(scene.isBuilt());
+        Writer out(filename, scene);
+
+        // materials and textures of objects, pictures of the textures
+        std::unordered_map<const Material*, COUNTTYPE> materialIds;
+        std::unordered_map<const Texture*, COUNTTYPE> textureIds;
+        std::unordered_map<const Picture*, COUNTTYPE> pictureIds;
+        std::vector<const Material*> allMaterials;
+        std::vector<const Texture*> allTextures;
+        std::vector<const Picture*> allPictures;
+        // and vertex arrays of meshes
+        std::unordered_map<const std::vector<Point>*, COUNTTYPE> vertexIds;
+        std::vector<const std::vector<Point>*> allVertices;
+        auto indexMaterial = [&](const Material* material, const Texture* texture) {
+            index(material, materialIds, allMaterials);
+            if (texture) {
+                index(texture, textureIds, allTextures);
+                index(&texture -> picture(), pictureIds, allPictures);
+            }
+        };
+        for (COUNTTYPE i = 0; i < scene.objectCount(); ++i) {
+            const Object* obj = scene.object(i);
+            if (obj -> type() != Object::MESH) {
+                indexMaterial(obj -> material(), obj -> texture());
+                continue;
+            }
+            const TriangleMesh* mesh = static_cast<const TriangleMesh*>(obj);
+            for (COUNTTYPE k = 0; k < mesh -> tableSize(); ++k) 
+                indexMaterial(mesh -> tableMaterial(k), mesh -> tableTexture(k));
+            index(mesh -> vertices().get(), vertexIds, allVertices);
+        }
+
+        char header[MAGICSIZE] = { 0 };
+        strncpy(header, magic(), MAGICSIZE);
+        out.write(header);
+        out.write(unsigned(VERSION));
+        out.write(unsigned(sizeof(ELEMTYPE)));
+        out.write(unsigned(sizeof(COUNTTYPE)));
+        out.write(unsigned(Lanes<ELEMTYPE>::WIDTH));
+
+        out.write(COUNTTYPE(allPictures.size()));
+        for (auto picture: allPictures) picture -> save(out);
+        out.write(COUNTTYPE(allTextures.size()));
+        for (auto texture: allTextures) {
+            out.write(pictureIds[&texture -> picture()]);
+            out.write(texture -> scale());
+            out.write(texture -> fillMode());
+        }
+        out.write(COUNTTYPE(allMaterials.size()));
+        for (auto material: allMaterials) out.write(*material);
+        out.write(COUNTTYPE(allVertices.size()));
+        for (auto vertices: allVertices) out.write(*vertices);
+
+        out.write(scene.objectCount());
+        for (COUNTTYPE i = 0; i < scene.objectCount(); ++i) {
+            const Object* obj = scene.object(i);
+            out.write(obj -> type());
+            if (obj -> type() == Object::MESH) {
+                // materials of the table, vertex array and faces
+                const TriangleMesh* mesh = static_cast<const TriangleMesh*>(obj);
+                out.write(mesh -> tableSize());
+                for (COUNTTYPE k = 0; k < mesh -> tableSize(); ++k) {
+                    out.write(materialIds[mesh -> tableMaterial(k)]);
+                    const Texture* texture = mesh -> tableTexture(k);
+                    out.write(texture? textureIds[texture]: COUNTTYPE(-1));
+                }
+                out.write(vertexIds[mesh -> vertices().get()]);
+                out.write(mesh -> faceCount());
+                for (COUNTTYPE f = 0; f < mesh -> faceCount(); ++f) out.write(mesh -> face(f));
+                continue;
+            }
+            out.write(materialIds[obj -> material()]);
+            out.write(obj -> texture()? textureIds[obj -> texture()]: COUNTTYPE(-1));
+            switch (obj -> type()) {
+                case Object::SPHERE: {
+                    const Sphere* sphere = static_cast<const Sphere*>(obj);
+                    out.write(sphere -> center());
+                    out.write(sphere -> radius());
+                    break;
+                }
+                case Object::TRIANGLE:
+                    for (COUNTTYPE k = 0; k < 3; ++k)
+                        out.write(static_cast<const Triangle*>(obj) -> vertices(k));
+                    break;
+                case Object::RECTANGLE:
+                    for (COUNTTYPE k = 0; k < 4; ++k)
+                        out.write(static_cast<const Rectangle*>(obj) -> vertices(k));
+                    break;
+                default:
+                    assert(0); // should never happen
+            }
+        }
+
+        out.write(scene.lightCount());
+        for (COUNTTYPE i = 0; i < scene.lightCount(); ++i) {
+            out.write(scene.light(i) -> position());
+            out.write(scene.light(i) -> color());
+        }
+
+        scene.save(out);
+        return out.close();
+    }
+
+private:
+    // what's read in place of objects and lights of a parsed scene
+    void load(Reader& in, Scene& scene) {
+        const char* header = in.bytes(MAGICSIZE);
+        if (!header || memcmp(header, magic(), MAGICSIZE)) return in.fail("not a compiled scene");
+        unsigned version, elemSize, countSize, width;
+        in.read(version);
+        if (in.good() && version != VERSION)
+            return in.fail("compiled by another version, compile the scene again");
+        in.read(elemSize);
+        in.read(countSize);
+        in.read(width);
+        if (in.good() && (elemSize != sizeof(ELEMTYPE) || countSize != sizeof(COUNTTYPE) ||
+                          width != unsigned(Lanes<ELEMTYPE>::WIDTH)))
+            return in.fail("compiled with another precision or SIMD width, compile the scene again");
+
+        COUNTTYPE count;
+        in.readCount(count);
+        for (COUNTTYPE i = 0; i < count && in.good(); ++i) {
+            pictures.push_back(std::make_shared<Picture>());
+            pictures.back() -> load(in);
+        }
+        in.readCount(count);
+        for (COUNTTYPE i = 0; i < count && in.good(); ++i) {
+            COUNTTYPE picture;
+            ELEMTYPE scale;
+            // enums as their underlying type, until they are known to be valid
+            std::underlying_type<Texture::FILLMODE>::type fillMode;
+            in.read(picture);
+            in.read(scale);
+            in.read(fillMode);
+            if (!in.check(picture >= 0 && picture < COUNTTYPE(pictures.size()) && 
+                          fillMode >= Texture::STRETCH && fillMode <= Texture::TILE)) return;
+            textures.push_back(scene.arena().create<Texture>(pictures[picture], scale));
+            textures.back() -> setFillMode(Texture::FILLMODE(fillMode));
+        }
+        in.readCount(count);
+        for (COUNTTYPE i = 0; i < count && in.good(); ++i) {
+            Material material(blackColor, 0, 0, 0, 0);
+            in.read(material);
+            materials.push_back(scene.arena().create<Material>(material));
+        }
+        in.readCount(count);
+        for (COUNTTYPE i = 0; i < count && in.good(); ++i) {
+            std::shared_ptr< std::vector<Point> > vertices = std::make_shared< std::vector<Point> >();
+            in.read(*vertices);
+            meshVertices.push_back(vertices);
+        }
+
+        in.readCount(count);
+        for (COUNTTYPE i = 0; i < count && in.good(); ++i) {
+            std::underlying_type<Object::OBJECT_TYPE>::type type;
+            in.read(type);
+            if (type == Object::MESH) {
+                TriangleMesh* mesh = loadMesh(in, scene);
+                if (!mesh) return;
+                objects.push_back(mesh);
+                scene.insert(mesh);
+                continue;
+            }
+            const Material* material;
+            const Texture* texture;
+            if (!readMaterial(in, material, texture)) return;
+            Point v[4];
+            ELEMTYPE radius;
+            switch (type) {
+                case Object::SPHERE:
+                    in.read(v[0]);
+                    in.read(radius);
+                    if (!in.check(radius > 0)) return;
+                    objects.push_back(scene.arena().create<Sphere>(v[0], radius, material, texture));
+                    break;
+                case Object::TRIANGLE:
+                    for (COUNTTYPE k = 0; k < 3; ++k) in.read(v[k]);
+                    if (!in.good()) return;
+                    objects.push_back(scene.arena().create<Triangle>(v[0], v[1], v[2], material, texture, 0));
+                    break;
+                case Object::RECTANGLE:
+                    for (COUNTTYPE k = 0; k < 4; ++k) in.read(v[k]);
+                    if (!in.check(Rectangle::isRectangle(v[0], v[1], v[2], v[3]))) return;
+                    objects.push_back(scene.arena().create<Rectangle>(v[0], v[1], v[2], v[3], material, texture));
+                    break;
+                default:
+                    return in.fail("corrupted");
+            }
+            scene.insert(objects.back());
+        }
+
+        in.readCount(count);
+        for (COUNTTYPE i = 0; i < count && in.good(); ++i) {
+            Point position;
+            Color color(blackColor);
+            in.read(position);
+            in.read(color);
+            scene.insert(scene.arena().create<LightSource>(position, color));
+        }
+        if (!in.good()) return;
+
+        scene.load(in);
+        in.check(in.end());
+    }
+
+public:
+    // reads a compiled scene into scene, which is built when it returns.
+    // what's read is made in the arena of scene and lives as long as it.
+    // if the file can't be read, good() is false and error() tells why
+    SceneFile(const std::string& filename, Scene& scene) {
+        Reader in(filename, objects, scene);
+        load(in, scene);
+        if (!in.good()) _error = filename + ": " + in.error();
+    }
+
+    bool good() const { return _error.empty(); }
+    // "file: message" if the file can't be read
+    const std::string& error() const { return _error; }
+
+    SceneFile(const SceneFile&) = delete;
+    SceneFile& operator=(const SceneFile&) = delete;
+};
+
+#endif /* SCENEFILE_H */
@@ -0,0 +1,135 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: scheduler.h
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 13:20:44
+ *  Description: Work stealing scheduler. Tasks are dealt to worker threads
+ *               in contiguous blocks, a thread running out of work steals
+ *               from the back of other threads' queues.
+ *****************************************************************************/
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <string>
+#include <sstream>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "common.h"
+
+using namespace RayTracing;
+
+class TileScheduler {
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<COUNTTYPE> tasks;
+    };
+
+    std::vector< std::unique_ptr<WorkQueue> > queues;
+    COUNTTYPE _threadCount;
+    // cpu of each thread, thread k runs on _cpus[k % _cpus.size()], empty if not pinned
+    std::vector<COUNTTYPE> _cpus;
+
+    // owner takes tasks from the front
+    bool pop(const COUNTTYPE k, COUNTTYPE& task) {
+        std::lock_guard<std::mutex> guard(queues[k] -> lock);
+        if (queues[k] -> tasks.empty()) return 0;
+        task = queues[k] -> tasks.front();
+        queues[k] -> tasks.pop_front();
+        return 1;
+    }
+
+    // thieves take tasks from the back, which are far from what the owner works on
+    bool steal(const COUNTTYPE k, COUNTTYPE& task) {
+        for (COUNTTYPE i = 1; i < _threadCount; ++i) {
+            WorkQueue& victim = *queues[(k + i) % _threadCount];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (victim.tasks.empty()) continue;
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return 1;
+        }
+        return 0;
+    }
+
+    void pin(std::thread& t, const COUNTTYPE k) const {
+        if (_cpus.empty()) return;
+#ifdef __linux__
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(_cpus[k % _cpus.size()], &cpuSet);
+        pthread_setaffinity_np(t.native_handle(), sizeof(cpu_set_t), &cpuSet);
+#else
+        (void)t; (void)k;
+#endif
+    }
+
+public:
+    // threadCount is number of hardware threads if 0
+    TileScheduler(const COUNTTYPE threadCount = 0,
+                  const std::vector<COUNTTYPE>& cpus = std::vector<COUNTTYPE>()):
+        _threadCount(threadCount), _cpus(cpus) {
+        if (_threadCount <= 0) _threadCount = std::thread::hardware_concurrency();
+        if (_threadCount <= 0) _threadCount = 1;
+        for (COUNTTYPE k = 0; k < _threadCount; ++k)
+            queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue));
+    }
+
+    COUNTTYPE threadCount() const { return _threadCount; }
+
+    // parses cpu list such as "0,2,4-7"
+    static std::vector<COUNTTYPE> parseCpuList(const std::string& str) {
+        std::vector<COUNTTYPE> cpus;
+        std::istringstream strs(str);
+        std::string range;
+        while (getline(strs, range, ',')) {
+            if (!range.length()) continue;
+            auto pos = range.find('-');
+            COUNTTYPE first = std::stoi(range.substr(0, pos));
+            COUNTTYPE last = pos == std::string::npos? first: std::stoi(range.substr(pos + 1));
+            assert(first >= 0 && first <= last);
+            for (COUNTTYPE cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    template < class TASKFUNC >
+    // runs func(task) for each task in [0, taskCount), returns when all are done
+    void run(const COUNTTYPE taskCount, TASKFUNC func) {
+        // deal contiguous blocks so each thread starts on neighboring tasks
+        for (COUNTTYPE k = 0; k < _threadCount; ++k) {
+            COUNTTYPE first = COUNTTYPE((long long)taskCount * k / _threadCount);
+            COUNTTYPE last = COUNTTYPE((long long)taskCount * (k + 1) / _threadCount);
+            for (COUNTTYPE task = first; task < last; ++task)
+                queues[k] -> tasks.push_back(task);
+        }
+
+        // no task is added while running,
+        // a thread finding all queues empty can exit
+        auto worker = [&](const COUNTTYPE k) {
+            COUNTTYPE task;
+            while (pop(k, task) || steal(k, task))
+                func(task);
+        };
+
+        std::vector<std::thread> threads;
+        for (COUNTTYPE k = 0; k < _threadCount; ++k) {
+            threads.push_back(std::thread(worker, k));
+            pin(threads.back(), k);
+        }
+        for (auto& t: threads) t.join();
+    }
+};
+
+#endif /* SCHEDULER_H */
@@ -0,0 +1,245 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: simd.h
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 16:40:12
+ *  Description: Lanes of numbers computed together. Uses AVX or SSE2 when
+ *               the compiler targets them, one lane of plain numbers
+ *               otherwise.
+ *****************************************************************************/
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cmath>
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "common.h"
+
+namespace RayTracing {
+
+// portable version, one lane
+template < class T >
+struct Lanes {
+    constexpr static COUNTTYPE WIDTH = 1;
+
+    struct Mask {
+        bool m;
+        Mask operator&(const Mask& o) const { return Mask{ m && o.m }; }
+        Mask operator|(const Mask& o) const { return Mask{ m || o.m }; }
+        Mask operator!() const { return Mask{ !m }; }
+        // bit k is set if lane k is set
+        int bits() const { return m; }
+    };
+
+    T v;
+
+    static Lanes load(const T* p) { return Lanes{ *p }; }
+    void store(T* p) const { *p = v; }
+    static Lanes broadcast(const T x) { return Lanes{ x }; }
+    static Lanes select(const Mask& m, const Lanes& a, const Lanes& b) { return m.m? a: b; }
+
+    Lanes operator+(const Lanes& o) const { return Lanes{ v + o.v }; }
+    Lanes operator-(const Lanes& o) const { return Lanes{ v - o.v }; }
+    Lanes operator*(const Lanes& o) const { return Lanes{ v * o.v }; }
+    Lanes operator/(const Lanes& o) const { return Lanes{ v / o.v }; }
+    Lanes operator-() const { return Lanes{ -v }; }
+    Lanes sqrt() const { return Lanes{ std::sqrt(v) }; }
+    // o where either is NaN, as with the instructions
+    Lanes min(const Lanes& o) const { return Lanes{ v < o.v? v: o.v }; }
+    Lanes max(const Lanes& o) const { return Lanes{ v > o.v? v: o.v }; }
+
+    Mask operator<(const Lanes& o) const { return Mask{ v < o.v }; }
+    Mask operator>(const Lanes& o) const { return Mask{ v > o.v }; }
+    Mask operator==(const Lanes& o) const { return Mask{ v == o.v }; }
+
+    T operator[](const COUNTTYPE) const { return v; }
+};
+
+#if defined(__AVX__)
+template < >
+struct Lanes<double> {
+    constexpr static COUNTTYPE WIDTH = 4;
+
+    struct Mask {
+        __m256d m;
+        Mask operator&(const Mask& o) const { return Mask{ _mm256_and_pd(m, o.m) }; }
+        Mask operator|(const Mask& o) const { return Mask{ _mm256_or_pd(m, o.m) }; }
+        Mask operator!() const {
+            __m256d zero = _mm256_setzero_pd();
+            return Mask{ _mm256_xor_pd(m, _mm256_cmp_pd(zero, zero, _CMP_EQ_OQ)) };
+        }
+        int bits() const { return _mm256_movemask_pd(m); }
+    };
+
+    __m256d v;
+
+    static Lanes load(const double* p) { return Lanes{ _mm256_loadu_pd(p) }; }
+    void store(double* p) const { _mm256_storeu_pd(p, v); }
+    static Lanes broadcast(const double x) { return Lanes{ _mm256_set1_pd(x) }; }
+    static Lanes select(const Mask& m, const Lanes& a, const Lanes& b) {
+        return Lanes{ _mm256_blendv_pd(b.v, a.v, m.m) };
+    }
+
+    Lanes operator+(const Lanes& o) const { return Lanes{ _mm256_add_pd(v, o.v) }; }
+    Lanes operator-(const Lanes& o) const { return Lanes{ _mm256_sub_pd(v, o.v) }; }
+    Lanes operator*(const Lanes& o) const { return Lanes{ _mm256_mul_pd(v, o.v) }; }
+    Lanes operator/(const Lanes& o) const { return Lanes{ _mm256_div_pd(v, o.v) }; }
+    Lanes operator-() const { return Lanes{ _mm256_xor_pd(v, _mm256_set1_pd(-0.0)) }; }
+    Lanes sqrt() const { return Lanes{ _mm256_sqrt_pd(v) }; }
+    Lanes min(const Lanes& o) const { return Lanes{ _mm256_min_pd(v, o.v) }; }
+    Lanes max(const Lanes& o) const { return Lanes{ _mm256_max_pd(v, o.v) }; }
+
+    Mask operator<(const Lanes& o) const { return Mask{ _mm256_cmp_pd(v, o.v, _CMP_LT_OQ) }; }
+    Mask operator>(const Lanes& o) const { return Mask{ _mm256_cmp_pd(v, o.v, _CMP_GT_OQ) }; }
+    Mask operator==(const Lanes& o) const { return Mask{ _mm256_cmp_pd(v, o.v, _CMP_EQ_OQ) }; }
+
+    double operator[](const COUNTTYPE k) const {
+        double lanes[WIDTH];
+        _mm256_storeu_pd(lanes, v);
+        return lanes[k];
+    }
+};
+
+template < >
+struct Lanes<float> {
+    constexpr static COUNTTYPE WIDTH = 8;
+
+    struct Mask {
+        __m256 m;
+        Mask operator&(const Mask& o) const { return Mask{ _mm256_and_ps(m, o.m) }; }
+        Mask operator|(const Mask& o) const { return Mask{ _mm256_or_ps(m, o.m) }; }
+        Mask operator!() const {
+            __m256 zero = _mm256_setzero_ps();
+            return Mask{ _mm256_xor_ps(m, _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ)) };
+        }
+        int bits() const { return _mm256_movemask_ps(m); }
+    };
+
+    __m256 v;
+
+    static Lanes load(const float* p) { return Lanes{ _mm256_loadu_ps(p) }; }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+    static Lanes broadcast(const float x) { return Lanes{ _mm256_set1_ps(x) }; }
+    static Lanes select(const Mask& m, const Lanes& a, const Lanes& b) {
+        return Lanes{ _mm256_blendv_ps(b.v, a.v, m.m) };
+    }
+
+    Lanes operator+(const Lanes& o) const { return Lanes{ _mm256_add_ps(v, o.v) }; }
+    Lanes operator-(const Lanes& o) const { return Lanes{ _mm256_sub_ps(v, o.v) }; }
+    Lanes operator*(const Lanes& o) const { return Lanes{ _mm256_mul_ps(v, o.v) }; }
+    Lanes operator/(const Lanes& o) const { return Lanes{ _mm256_div_ps(v, o.v) }; }
+    Lanes operator-() const { return Lanes{ _mm256_xor_ps(v, _mm256_set1_ps(-0.0f)) }; }
+    Lanes sqrt() const { return Lanes{ _mm256_sqrt_ps(v) }; }
+    Lanes min(const Lanes& o) const { return Lanes{ _mm256_min_ps(v, o.v) }; }
+    Lanes max(const Lanes& o) const { return Lanes{ _mm256_max_ps(v, o.v) }; }
+
+    Mask operator<(const Lanes& o) const { return Mask{ _mm256_cmp_ps(v, o.v, _CMP_LT_OQ) }; }
+    Mask operator>(const Lanes& o) const { return Mask{ _mm256_cmp_ps(v, o.v, _CMP_GT_OQ) }; }
+    Mask operator==(const Lanes& o) const { return Mask{ _mm256_cmp_ps(v, o.v, _CMP_EQ_OQ) }; }
+
+    float operator[](const COUNTTYPE k) const {
+        float lanes[WIDTH];
+        _mm256_storeu_ps(lanes, v);
+        return lanes[k];
+    }
+};
+
+#elif defined(__SSE2__)
+template < >
+struct Lanes<double> {
+    constexpr static COUNTTYPE WIDTH = 2;
+
+    struct Mask {
+        __m128d m;
+        Mask operator&(const Mask& o) const { return Mask{ _mm_and_pd(m, o.m) }; }
+        Mask operator|(const Mask& o) const { return Mask{ _mm_or_pd(m, o.m) }; }
+        Mask operator!() const {
+            __m128d zero = _mm_setzero_pd();
+            return Mask{ _mm_xor_pd(m, _mm_cmpeq_pd(zero, zero)) };
+        }
+        int bits() const { return _mm_movemask_pd(m); }
+    };
+
+    __m128d v;
+
+    static Lanes load(const double* p) { return Lanes{ _mm_loadu_pd(p) }; }
+    void store(double* p) const { _mm_storeu_pd(p, v); }
+    static Lanes broadcast(const double x) { return Lanes{ _mm_set1_pd(x) }; }
+    static Lanes select(const Mask& m, const Lanes& a, const Lanes& b) {
+        return Lanes{ _mm_or_pd(_mm_and_pd(m.m, a.v), _mm_andnot_pd(m.m, b.v)) };
+    }
+
+    Lanes operator+(const Lanes& o) const { return Lanes{ _mm_add_pd(v, o.v) }; }
+    Lanes operator-(const Lanes& o) const { return Lanes{ _mm_sub_pd(v, o.v) }; }
+    Lanes operator*(const Lanes& o) const { return Lanes{ _mm_mul_pd(v, o.v) }; }
+    Lanes operator/(const Lanes& o) const { return Lanes{ _mm_div_pd(v, o.v) }; }
+    Lanes operator-() const { return Lanes{ _mm_xor_pd(v, _mm_set1_pd(-0.0)) }; }
+    Lanes sqrt() const { return Lanes{ _mm_sqrt_pd(v) }; }
+    Lanes min(const Lanes& o) const { return Lanes{ _mm_min_pd(v, o.v) }; }
+    Lanes max(const Lanes& o) const { return Lanes{ _mm_max_pd(v, o.v) }; }
+
+    Mask operator<(const Lanes& o) const { return Mask{ _mm_cmplt_pd(v, o.v) }; }
+    Mask operator>(const Lanes& o) const { return Mask{ _mm_cmpgt_pd(v, o.v) }; }
+    Mask operator==(const Lanes& o) const { return Mask{ _mm_cmpeq_pd(v, o.v) }; }
+
+    double operator[](const COUNTTYPE k) const {
+        double lanes[WIDTH];
+        _mm_storeu_pd(lanes, v);
+        return lanes[k];
+    }
+};
+
+template < >
+struct Lanes<float> {
+    constexpr static COUNTTYPE WIDTH = 4;
+
+    struct Mask {
+        __m128 m;
+        Mask operator&(const Mask& o) const { return Mask{ _mm_and_ps(m, o.m) }; }
+        Mask operator|(const Mask& o) const { return Mask{ _mm_or_ps(m, o.m) }; }
+        Mask operator!() const {
+            __m128 zero = _mm_setzero_ps();
+            return Mask{ _mm_xor_ps(m, _mm_cmpeq_ps(zero, zero)) };
+        }
+        int bits() const { return _mm_movemask_ps(m); }
+    };
+
+    __m128 v;
+
+    static Lanes load(const float* p) { return Lanes{ _mm_loadu_ps(p) }; }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+    static Lanes broadcast(const float x) { return Lanes{ _mm_set1_ps(x) }; }
+    static Lanes select(const Mask& m, const Lanes& a, const Lanes& b) {
+        return Lanes{ _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)) };
+    }
+
+    Lanes operator+(const Lanes& o) const { return Lanes{ _mm_add_ps(v, o.v) }; }
+    Lanes operator-(const Lanes& o) const { return Lanes{ _mm_sub_ps(v, o.v) }; }
+    Lanes operator*(const Lanes& o) const { return Lanes{ _mm_mul_ps(v, o.v) }; }
+    Lanes operator/(const Lanes& o) const { return Lanes{ _mm_div_ps(v, o.v) }; }
+    Lanes operator-() const { return Lanes{ _mm_xor_ps(v, _mm_set1_ps(-0.0f)) }; }
+    Lanes sqrt() const { return Lanes{ _mm_sqrt_ps(v) }; }
+    Lanes min(const Lanes& o) const { return Lanes{ _mm_min_ps(v, o.v) }; }
+    Lanes max(const Lanes& o) const { return Lanes{ _mm_max_ps(v, o.v) }; }
+
+    Mask operator<(const Lanes& o) const { return Mask{ _mm_cmplt_ps(v, o.v) }; }
+    Mask operator>(const Lanes& o) const { return Mask{ _mm_cmpgt_ps(v, o.v) }; }
+    Mask operator==(const Lanes& o) const { return Mask{ _mm_cmpeq_ps(v, o.v) }; }
+
+    float operator[](const COUNTTYPE k) const {
+        float lanes[WIDTH];
+        _mm_storeu_ps(lanes, v);
+        return lanes[k];
+    }
+};
+#endif
+
+} // namespace RayTracing
+
+#endif /* SIMD_H */
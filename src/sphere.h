@@ -22,32 +22,37 @@ class Sphere: public Object {
     Point _center;
     ELEMTYPE _radius;
 
+    void boundsChanged() {
+        setBounds(_center - Vector(_radius, _radius, _radius), 
+                  _center + Vector(_radius, _radius, _radius));
+    }
+
 public:
     Sphere(const Point& c, const ELEMTYPE r, 
            const Material* mat, const Texture* tex):
-        Object(mat, tex), _center(c), _radius(r) { 
+        Object(SPHERE, mat, tex), _center(c), _radius(r) { 
+        boundsChanged();
     }
 
     virtual ~Sphere() { }
 
-    ELEMTYPE lowerBoundX() const { return _center[0] - _radius; }
-    ELEMTYPE upperBoundX() const { return _center[0] + _radius; }
-    ELEMTYPE lowerBoundY() const { return _center[1] - _radius; }
-    ELEMTYPE upperBoundY() const { return _center[1] + _radius; }
-    ELEMTYPE lowerBoundZ() const { return _center[2] - _radius; }
-    ELEMTYPE upperBoundZ() const { return _center[2] + _radius; }
-    void setCenter(const Point& center) { _center = center; }
+    void setCenter(const Point& center) { _center = center; boundsChanged(); }
     Point center() const { return _center; } 
-    void setRadius(const ELEMTYPE radius) { _radius = radius; }
+    void setRadius(const ELEMTYPE radius) { _radius = radius; boundsChanged(); }
     ELEMTYPE radius() const { return _radius; }
 
-    Color color() const { return _material -> color(); }
+    // the sphere has a texture
+    Color texture(const Hit& hit) const { 
+        // a unit of u or v is about half a great circle
+        return _texture -> getPixel(hit.u, hit.v, 1, 1, hit.footprint / (PI * _radius));
+    }
 
-    Color texture(const Point& p) const { 
-        // if there's not texture
-        if (!_texture) return color(); 
+    void fillHit(const Ray& ray, Hit& hit) const {
+        hit.point = ray.origin() + hit.distance * ray.direction();
+        hit.normal = (hit.point - _center).normalize();
+        if (!_texture) return;
 
-        Vector n = normal(p);
+        const Vector& n = hit.normal;
         //theta in [0, pi]
         //phi in [0, 2pi]
         ELEMTYPE angleTheta = acos(n[2] / n.norm()); 
@@ -55,22 +60,13 @@ public:
                              2 * PI - acos(n[0] / sqrt(n[0] * n[0] + n[1] * n[1]));
 
         //x, y in [0, 1]
-        ELEMTYPE x = asin(2 * angleTheta / PI - 1) / PI + 0.5;
-        ELEMTYPE y = asin(anglePhi / PI - 1) / PI + 0.5;
-        
-        return _texture -> getPixel(x, y, 1, 1);
-
-        //return color();
-    }
-
-    Vector normal(const Point& p) const {
-        Vector n = p - _center;
-        return n.normalize();
+        hit.u = asin(2 * angleTheta / PI - 1) / PI + 0.5;
+        hit.v = asin(anglePhi / PI - 1) / PI + 0.5;
     }
 
     INTERSECTED_TYPE isIntersected(const Ray& ray, ELEMTYPE& distance) const {
         // distance is positive infinity
-        distance = DOUBLE_MAX;
+        distance = ELEMTYPE_MAX;
 
         // algorithm:
         // Sc: center of sphere
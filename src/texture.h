@@ -9,80 +9,258 @@
  *  Date: Apr. 18, 2014
  *  Time: 14:36:47
  *  Description: texture, including a picture. 
+ *               Texels are packed 8-bit RGB in tiles. A mip pyramid is
+ *               built when the picture is set, lookups are trilinear.
+ *               A picture may be shared by textures of many materials.
  *****************************************************************************/
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
 #include "common.h"
 #include "vector"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <cstdint>
 
 using namespace RayTracing;
 
+// texels of a picture and its mip pyramid
+class Picture {
+    // texels are 8-bit RGB, stored in square tiles of TILESIZE * TILESIZE texels
+    // row by row, tiles row by row. a tile is a few cache lines,
+    // nearby lookups in both directions mostly hit the same tile
+    constexpr static COUNTTYPE TILESIZE = 8;
+    constexpr static COUNTTYPE CHANNELS = 3;
+
+    // a level of the mip pyramid, level 0 is the picture, 
+    // each next one is half as long and wide, down to 1 * 1
+    struct Level {
+        COUNTTYPE length;
+        COUNTTYPE width;
+        COUNTTYPE tilesPerRow;
+        size_t offset; // of its first texel in _texels
+    };
+
+    COUNTTYPE _length;
+    COUNTTYPE _width;
+    std::vector<Level> _levels;
+    std::vector<unsigned char> _texels;
+
+    // index in _texels of the texel at row y, column x of level
+    size_t texel(const Level& level, const COUNTTYPE x, const COUNTTYPE y) const {
+        assert(x >= 0 && x < level.length && y >= 0 && y < level.width);
+        size_t tile = size_t(y / TILESIZE) * level.tilesPerRow + x / TILESIZE;
+        size_t offset = (y % TILESIZE) * TILESIZE + x % TILESIZE;
+        return level.offset + (tile * TILESIZE * TILESIZE + offset) * CHANNELS;
+    }
+
+    // each texel of a level is the average of the 2 * 2 texels of the level above,
+    // 3 texels across for the last one of an odd length or width
+    void buildMipmaps() {
+        for (size_t k = 1; k < _levels.size(); ++k) {
+            const Level& src = _levels[k - 1];
+            const Level& dst = _levels[k];
+            for (COUNTTYPE y = 0; y < dst.width; ++y) {
+                COUNTTYPE y0 = std::min(2 * y, src.width - 1);
+                COUNTTYPE y1 = y == dst.width - 1? src.width - 1: 2 * y + 1;
+                for (COUNTTYPE x = 0; x < dst.length; ++x) {
+                    COUNTTYPE x0 = std::min(2 * x, src.length - 1);
+                    COUNTTYPE x1 = x == dst.length - 1? src.length - 1: 2 * x + 1;
+                    unsigned sum[CHANNELS] = { 0 };
+                    for (COUNTTYPE yy = y0; yy <= y1; ++yy)
+                        for (COUNTTYPE xx = x0; xx <= x1; ++xx) {
+                            const unsigned char* t = &_texels[texel(src, xx, yy)];
+                            for (COUNTTYPE c = 0; c < CHANNELS; ++c) sum[c] += t[c];
+                        }
+                    unsigned count = (x1 - x0 + 1) * (y1 - y0 + 1);
+                    unsigned char* t = &_texels[texel(dst, x, y)];
+                    for (COUNTTYPE c = 0; c < CHANNELS; ++c) t[c] = (sum[c] + count / 2) / count;
+                }
+            }
+        }
+    }
+
+    // adds weight * texel (x, y) of level to rgb
+    void fetch(const Level& level, const COUNTTYPE x, const COUNTTYPE y, 
+               const ELEMTYPE weight, ELEMTYPE rgb[3]) const {
+        const unsigned char* t = &_texels[texel(level, x, y)];
+        for (COUNTTYPE c = 0; c < CHANNELS; ++c) rgb[c] += weight * t[c];
+    }
+
+    // x and x + 1 wrapped around, or clamped to [0, n) 
+    static void neighbors(const COUNTTYPE x, const COUNTTYPE n, const bool wrap, 
+                          COUNTTYPE& x0, COUNTTYPE& x1) {
+        if (wrap) {
+            x0 = x % n;
+            if (x0 < 0) x0 += n;
+            x1 = x0 + 1 == n? 0: x0 + 1;
+        } else {
+            x0 = std::min(std::max(x, 0), n - 1);
+            x1 = std::min(std::max(x + 1, 0), n - 1);
+        }
+    }
+
+public:
+    Picture(): _length(0), _width(0) { }
+
+    COUNTTYPE length() const { return _length; }
+    COUNTTYPE width() const { return _width; }
+    COUNTTYPE levels() const { return _levels.size(); }
+    // bytes taken by texels
+    size_t memory() const { return _texels.size(); }
+
+    // l texels in a row, w rows, all black
+    void setSize(const COUNTTYPE l, const COUNTTYPE w) {
+        assert(l >= 0 && w >= 0);
+        _length = l;
+        _width = w;
+        _levels.clear();
+        size_t size = 0;
+        for (COUNTTYPE ll = l, ww = w; ll > 0 && ww > 0; ll = std::max(ll / 2, 1), ww = std::max(ww / 2, 1)) {
+            Level level;
+            level.length = ll;
+            level.width = ww;
+            level.tilesPerRow = (ll + TILESIZE - 1) / TILESIZE;
+            level.offset = size;
+            COUNTTYPE tileRows = (ww + TILESIZE - 1) / TILESIZE;
+            size += size_t(level.tilesPerRow) * tileRows * TILESIZE * TILESIZE * CHANNELS;
+            _levels.push_back(level);
+            if (ll == 1 && ww == 1) break;
+        }
+        _texels.assign(size, 0);
+    }
+
+    // copies a picture of l * w texels, 8-bit BGR as loaded by OpenCV, 
+    // row y starts at bgr + y * rowStride bytes, and builds its mip pyramid
+    void setPixels(const unsigned char* bgr, const COUNTTYPE l, const COUNTTYPE w, const size_t rowStride) {
+        setSize(l, w);
+        for (COUNTTYPE y = 0; y < w; ++y) {
+            const unsigned char* row = bgr + y * rowStride;
+            for (COUNTTYPE x0 = 0; x0 < l; x0 += TILESIZE) {
+                // a row of a tile is contiguous
+                unsigned char* t = &_texels[texel(_levels[0], x0, y)];
+                COUNTTYPE count = std::min(COUNTTYPE(TILESIZE), l - x0);
+                for (COUNTTYPE x = 0; x < count; ++x, t += CHANNELS) {
+                    const unsigned char* p = row + (x0 + x) * CHANNELS;
+                    t[0] = p[2];
+                    t[1] = p[1];
+                    t[2] = p[0];
+                }
+            }
+        }
+        buildMipmaps();
+    }
+
+    template < class WRITER >
+    // writes size and texels of all levels, to be read back by load
+    void save(WRITER& out) const {
+        out.write(_length);
+        out.write(_width);
+        out.write(_texels);
+    }
+
+    template < class READER >
+    void load(READER& in) {
+        COUNTTYPE l, w;
+        in.read(l);
+        in.read(w);
+        // texels are read after their count, there are at least as many bytes left
+        if (!in.check(l > 0 && w > 0 && uint64_t(l) * w <= in.left())) return;
+        setSize(l, w);
+        size_t size = _texels.size();
+        in.read(_texels);
+        in.check(_texels.size() == size);
+    }
+
+    // adds weight * bilinear filtered level k at (s, t) in texels of level 0 to rgb,
+    // coordinates out of the picture wrap around or are clamped to the edges
+    void sample(const COUNTTYPE k, ELEMTYPE s, ELEMTYPE t, const bool wrap,
+                const ELEMTYPE weight, ELEMTYPE rgb[3]) const {
+        assert(k >= 0 && k < levels());
+        const Level& level = _levels[k];
+        // texel centers are at halves
+        s = s * level.length / _length - ELEMTYPE(0.5);
+        t = t * level.width / _width - ELEMTYPE(0.5);
+        // far out of the picture the edges are all that's left
+        if (!wrap) {
+            s = std::min(std::max(s, ELEMTYPE(-1)), ELEMTYPE(level.length));
+            t = std::min(std::max(t, ELEMTYPE(-1)), ELEMTYPE(level.width));
+        }
+        ELEMTYPE sFloor = std::floor(s), tFloor = std::floor(t);
+        ELEMTYPE fs = s - sFloor, ft = t - tFloor;
+        COUNTTYPE x0, x1, y0, y1;
+        neighbors(COUNTTYPE(sFloor), level.length, wrap, x0, x1);
+        neighbors(COUNTTYPE(tFloor), level.width, wrap, y0, y1);
+        fetch(level, x0, y0, weight * (1 - fs) * (1 - ft), rgb);
+        fetch(level, x1, y0, weight * fs * (1 - ft), rgb);
+        fetch(level, x0, y1, weight * (1 - fs) * ft, rgb);
+        fetch(level, x1, y1, weight * fs * ft, rgb);
+    }
+};
+
+// a picture and how it's laid on surfaces
 class Texture {
 public:
     enum FILLMODE { STRETCH = 0, PRESERVEASPECTFIT = 1, PRESERVEASPECTCROP = 2,
                     TILE = 3 };
 private:
-    COUNTTYPE _length;
-    COUNTTYPE _width;
-    std::vector< std::vector<Color> > _pixels;
-    COUNTTYPE pixelsNum;
+    std::shared_ptr<const Picture> _picture;
     ELEMTYPE _scale;
     FILLMODE _fillMode;
+
 public:
-    Texture(const COUNTTYPE l, const COUNTTYPE w, const ELEMTYPE s = 1): 
-        _length(l), _width(w), pixelsNum(0), _scale(s), _fillMode(TILE){
+    Texture(const std::shared_ptr<const Picture>& picture, const ELEMTYPE s = 1): 
+        _picture(picture), _scale(s), _fillMode(TILE){
+        assert(_picture);
     }
 
-    COUNTTYPE length() const { return _length; }
-    COUNTTYPE width() const { return _width; }
+    // the picture may still be loading in the background, 
+    // only look at its size once TextureCache::wait() returns
+    const Picture& picture() const { return *_picture; }
+    COUNTTYPE length() const { return _picture -> length(); }
+    COUNTTYPE width() const { return _picture -> width(); }
     ELEMTYPE scale() const { return _scale; }
     FILLMODE fillMode() const { return _fillMode; }
     void setFillMode(const FILLMODE m) { _fillMode = m; }
     void setScale(const ELEMTYPE s) { _scale = s; }
-    void setLength(const COUNTTYPE l) { _length = l; }
-    void setWidth(const COUNTTYPE w) { _width = w; }
-
-    void clear() { 
-        _pixels.clear(); 
-        pixelsNum = _length = _width = 0;
-        _scale = 1;
-        _fillMode = TILE;
-    }
-
-    void setPixel(const Color& c) {
-        assert(pixelsNum < _length * _width);
-        while (_pixels.size() <= pixelsNum / _length) _pixels.push_back(std::vector<Color>());
-        _pixels[pixelsNum / _length].push_back(c);
-        ++pixelsNum;
-    }
 
+    // color at (x, y) of a surface of l * w, footprint is the width 
+    // in the same units of the ray cone there, which picks the levels 
+    // blended. if using tile mode, l and w are useless
     Color getPixel(const ELEMTYPE x, const ELEMTYPE y, 
-                   const ELEMTYPE l, const ELEMTYPE w) const  {
-    // if using tile mode, l and w are useless
-        assert(pixelsNum == _length * _width);
+                   const ELEMTYPE l, const ELEMTYPE w, const ELEMTYPE footprint = 0) const  {
+        const Picture& picture = *_picture;
+        assert(picture.length() > 0 && picture.width() > 0);
+        // texels of level 0 per unit of x and y
+        ELEMTYPE xScale = 0, yScale = 0;
         switch (_fillMode) {
-            case STRETCH: {
-                ELEMTYPE xx = x;
-                ELEMTYPE yy = y;
-                while (xx >= l) xx -= EPSILON;
-                while (yy >= w) yy -= EPSILON;
-                return _pixels[COUNTTYPE(_width * yy / w)][COUNTTYPE(_length * xx / l)];
-            }
+            case STRETCH:
+                if (l > 0) xScale = picture.length() / l;
+                if (w > 0) yScale = picture.width() / w;
+                break;
             case PRESERVEASPECTFIT:
             case PRESERVEASPECTCROP:
                 // TODO: implement these if necessary
-            case TILE: {
-                COUNTTYPE xx = COUNTTYPE(y / _scale) % _width;
-                COUNTTYPE yy = COUNTTYPE(x / _scale) % _length;
-                if (xx < 0) xx += _width;
-                if (yy < 0) yy += _length;
-                assert(xx >= 0 && yy >= 0);
-                return _pixels[xx][yy];
-            }
+            case TILE:
+                xScale = yScale = 1 / _scale;
+                break;
             default:
                 assert(0); // should never happen
         }
+
+        // level of detail, where the footprint is about a texel
+        ELEMTYPE texels = footprint * std::max(xScale, yScale);
+        ELEMTYPE lod = texels > 1? std::log2(texels): 0;
+        lod = std::min(lod, ELEMTYPE(picture.levels() - 1));
+        COUNTTYPE k = COUNTTYPE(lod);
+        ELEMTYPE blend = lod - k;
+
+        ELEMTYPE rgb[3] = { 0, 0, 0 };
+        bool wrap = _fillMode != STRETCH;
+        picture.sample(k, x * xScale, y * yScale, wrap, 1 - blend, rgb);
+        if (blend > 0) picture.sample(k + 1, x * xScale, y * yScale, wrap, blend, rgb);
+        return Color(rgb[0], rgb[1], rgb[2]);
     }
 };
 
@@ -0,0 +1,145 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: texturecache.h
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 23:12:05
+ *  Description: Pictures of textures, loaded once per file content and
+ *               shared by all materials using them. Files are decoded by
+ *               worker threads while the scene is parsed and built.
+ *****************************************************************************/
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include "common.h"
+#include "texture.h"
+
+using namespace RayTracing;
+
+class TextureCache {
+    struct Task {
+        std::shared_ptr<Picture> picture;
+        std::vector<unsigned char> bytes;
+        std::string filename;
+    };
+
+    // pictures by file name, and by hash and size of file content
+    std::map< std::string, std::shared_ptr<Picture> > byName;
+    std::map< std::pair<unsigned long long, size_t>, std::shared_ptr<Picture> > byContent;
+
+    std::mutex lock;
+    std::deque<Task> tasks;
+    std::vector<std::thread> workers;
+    COUNTTYPE _running;
+    COUNTTYPE _decoded;
+    // files that can't be decoded, their pictures are left empty
+    std::vector<std::string> _failed;
+
+    TextureCache(): _running(0), _decoded(0) { }
+    ~TextureCache() { wait(); }
+
+    // FNV-1a
+    static unsigned long long hash(const std::vector<unsigned char>& bytes) {
+        unsigned long long h = 14695981039346656037ull;
+        for (auto b: bytes) h = (h ^ b) * 1099511628211ull;
+        return h;
+    }
+
+    // returns false if the file isn't a picture
+    static bool decode(Task& task) {
+        cv::Mat_<cv::Vec3b> image = cv::imdecode(task.bytes, cv::IMREAD_COLOR);
+        if (!image.data) return 0;
+        task.picture -> setPixels(image.data, image.cols, image.rows, image.step);
+        return 1;
+    }
+
+    // decodes files queued until there are none left
+    void work() {
+        while (1) {
+            Task task;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (tasks.empty()) { --_running; return; }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            if (!decode(task)) {
+                std::lock_guard<std::mutex> guard(lock);
+                _failed.push_back(task.filename);
+            }
+        }
+    }
+
+public:
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    static TextureCache& instance() {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // picture of file filename, it's decoded in the background if not loaded before.
+    // texels of it must not be read before wait() returns. nullptr if it can't be opened
+    std::shared_ptr<const Picture> load(const std::string& filename) {
+        auto named = byName.find(filename);
+        if (named != byName.end()) return named -> second;
+
+        std::ifstream fin(filename.c_str(), std::ios::binary);
+        if (!fin.is_open()) return nullptr;
+        Task task;
+        task.filename = filename;
+        task.bytes.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+
+        // the same picture under another name
+        auto key = std::make_pair(hash(task.bytes), task.bytes.size());
+        auto same = byContent.find(key);
+        if (same != byContent.end()) return byName[filename] = same -> second;
+
+        task.picture = std::make_shared<Picture>();
+        byName[filename] = byContent[key] = task.picture;
+        ++_decoded;
+
+        std::lock_guard<std::mutex> guard(lock);
+        tasks.push_back(std::move(task));
+        COUNTTYPE maxWorkers = std::max(std::thread::hardware_concurrency(), 1u);
+        if (_running < maxWorkers) {
+            ++_running;
+            workers.push_back(std::thread(&TextureCache::work, this));
+        }
+        return byName[filename];
+    }
+
+    // waits for all pictures loaded to be decoded, returns errors of the files
+    // that can't be as "can't decode texture filename". pictures of them are empty
+    std::vector<std::string> wait() {
+        for (auto& worker: workers) worker.join();
+        workers.clear();
+        assert(tasks.empty() && !_running);
+        std::sort(_failed.begin(), _failed.end());
+        std::vector<std::string> errors;
+        for (auto& filename: _failed) errors.push_back("can't decode texture " + filename);
+        _failed.clear();
+        return errors;
+    }
+
+    // number of files decoded, each file content once
+    COUNTTYPE decoded() const { return _decoded; }
+};
+
+#endif /* TEXTURECACHE_H */
@@ -21,64 +21,83 @@ using namespace RayTracing;
 
 class Triangle: public Object {
     Point _vertices[3];
+    // constant data of intersection and texture mapping:
+    // AB = A - B, CA = C - A, unit normal and texture axes in the plane
+    Vector _ab;
+    Vector _ca;
+    Vector _normal;
+    Vector _xAxis;
+    Vector _yAxis;
 
 public:
+    // vertices of a triangle read back from a compiled scene are already enlarged
     Triangle(const Point& p0, const Point& p1, const Point& p2, 
-             const Material* mat, const Texture* tex):
-        Object(mat, tex){
-        // the triangle should be a little larger to avoid black boundary
-        Point center = (p0 + p1 + p2) * (ELEMTYPE(1.0) / 3);
-        _vertices[0] = p0 + EPSILON * (p0 - center);
-        _vertices[1] = p1 + EPSILON * (p1 - center);
-        _vertices[2] = p2 + EPSILON * (p2 - center);
+             const Material* mat, const Texture* tex, const bool enlarge = 1):
+        Object(TRIANGLE, mat, tex){
+        const Point p[3] = { p0, p1, p2 };
+        if (enlarge) Triangle::enlarge(p, _vertices);
+        else std::copy(p, p + 3, _vertices);
+
+        _ab = _vertices[0] - _vertices[1];
+        _ca = _vertices[2] - _vertices[0];
+        _normal = crossProduct(_vertices[1] - _vertices[0], 
+                               _vertices[2] - _vertices[0]).normalize();
+        _xAxis = _ab.normalize();
+        _yAxis = crossProduct(_normal, _xAxis);
+        assert(std::abs(_yAxis.norm() - 1) < EPSILON);
+
+        Point lower, upper;
+        for (COUNTTYPE k = 0; k < 3; ++k) {
+            lower[k] = std::min(std::min(_vertices[0][k], _vertices[1][k]), _vertices[2][k]);
+            upper[k] = std::max(std::max(_vertices[0][k], _vertices[1][k]), _vertices[2][k]);
+        }
+        setBounds(lower, upper);
     }
 
     virtual ~Triangle() { }
 
-    ELEMTYPE lowerBoundX() const { return std::min(std::min(_vertices[0][0], _vertices[1][0]), _vertices[2][0]); }
-    ELEMTYPE upperBoundX() const { return std::max(std::max(_vertices[0][0], _vertices[1][0]), _vertices[2][0]); }
-    ELEMTYPE lowerBoundY() const { return std::min(std::min(_vertices[0][1], _vertices[1][1]), _vertices[2][1]); }
-    ELEMTYPE upperBoundY() const { return std::max(std::max(_vertices[0][1], _vertices[1][1]), _vertices[2][1]); }
-    ELEMTYPE lowerBoundZ() const { return std::min(std::min(_vertices[0][2], _vertices[1][2]), _vertices[2][2]); }
-    ELEMTYPE upperBoundZ() const { return std::max(std::max(_vertices[0][2], _vertices[1][2]), _vertices[2][2]); }
-
-    Point& vertices(const COUNTTYPE k) {
+    const Point& vertices(const COUNTTYPE k) const {
         assert(k >= 0 && k < 3);
         return _vertices[k];
     }
 
-    Color texture(const Point& p) const {
-        // if there isn't a texture returns the color
-        if (!_texture) return color();
-
-        Vector xAxis = (_vertices[0] - _vertices[1]).normalize();
-        Vector yAxis = crossProduct(normal(p), xAxis);
-        assert(std::abs(yAxis.norm() - 1) < EPSILON);
+    // AB and CA as in isIntersected
+    const Vector& ab() const { return _ab; }
+    const Vector& ca() const { return _ca; }
 
-        ELEMTYPE pX = (p - _vertices[0]) * xAxis;
-        ELEMTYPE pY = (p - _vertices[0]) * yAxis;
+    // the triangle has a texture
+    Color texture(const Hit& hit) const {
+        return _texture -> getPixel(hit.u, hit.v, hit.u, hit.v, hit.footprint);
+    }
 
-        return _texture -> getPixel(pX, pY, pX, pY);
+    void fillHit(const Ray& ray, Hit& hit) const {
+        hit.point = ray.origin() + hit.distance * ray.direction();
+        hit.normal = _normal;
+        hit.u = (hit.point - _vertices[0]) * _xAxis;
+        hit.v = (hit.point - _vertices[0]) * _yAxis;
     }
-    
-    Color color() const { return _material -> color(); }
 
-    Vector normal(const Point&) const { 
-        return crossProduct(_vertices[1] - _vertices[0], 
-                            _vertices[2] - _vertices[0]).normalize();
+    // the triangle should be a little larger to avoid black boundary
+    static void enlarge(const Point p[3], Point v[3]) {
+        Point center = (p[0] + p[1] + p[2]) * (ELEMTYPE(1.0) / 3);
+        for (COUNTTYPE k = 0; k < 3; ++k) v[k] = p[k] + EPSILON * (p[k] - center);
     }
 
     INTERSECTED_TYPE isIntersected(const Ray& ray, ELEMTYPE& distance) const {
-        Vector A_B = _vertices[0] - _vertices[1];
-        Vector C_A = _vertices[2] - _vertices[0];
-        Vector A_O = _vertices[0] - ray.origin();
+        return intersect(_vertices[0], _ab, _ca, ray, distance);
+    }
+
+    // triangle of first vertex A, AB = A - B and CA = C - A
+    static INTERSECTED_TYPE intersect(const Point& a, const Vector& A_B, const Vector& C_A, 
+                                      const Ray& ray, ELEMTYPE& distance) {
+        Vector A_O = a - ray.origin();
 
-        ELEMTYPE deterA = -1.0 * crossProduct(ray.direction(), C_A) * A_B;
+        ELEMTYPE deterA = ELEMTYPE(-1.0) * crossProduct(ray.direction(), C_A) * A_B;
         if (deterA == 0) return MISS;
 
-        ELEMTYPE beta = -1.0 * crossProduct(ray.direction(), C_A) * A_O / deterA;
+        ELEMTYPE beta = ELEMTYPE(-1.0) * crossProduct(ray.direction(), C_A) * A_O / deterA;
         ELEMTYPE gamma = crossProduct(ray.direction(), A_O) * A_B / deterA;
-        ELEMTYPE t = -1.0 * crossProduct(A_O, C_A) * A_B / deterA;
+        ELEMTYPE t = ELEMTYPE(-1.0) * crossProduct(A_O, C_A) * A_B / deterA;
         ELEMTYPE alpha = 1 - beta - gamma;
 
         if (t < 0 || beta < 0 || beta > 1 || gamma < 0 || gamma > 1 || alpha < 0 || alpha > 1) {
@@ -0,0 +1,192 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: trianglemesh.h
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 23:59:41
+ *  Description: Faces referring to a vertex array shared with other meshes
+ *               by 32-bit indices. A face is a triangle, or a flat quad
+ *               intersected as two triangles and textured like a rectangle.
+ *               Materials and textures of faces are in a small table of
+ *               the mesh, each face keeps the index in it.
+ *****************************************************************************/
+#ifndef TRIANGLEMESH_H
+#define TRIANGLEMESH_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "common.h"
+#include "object.h"
+#include "triangle.h"
+
+using namespace RayTracing;
+
+class TriangleMesh: public Object {
+public:
+    enum : uint32_t { NOVERTEX = 0xffffffffu };
+
+    // the fourth vertex of a triangle is NOVERTEX,
+    // material is the index in the table of the mesh
+    struct Face {
+        uint32_t vertices[4];
+        uint32_t material;
+    };
+
+private:
+    std::shared_ptr< const std::vector<Point> > _vertices;
+    std::vector<Face> _faces;
+    std::vector<const Material*> _materials;
+    std::vector<const Texture*> _textures;
+
+    const Point& vertex(const Face& face, const COUNTTYPE k) const { return (*_vertices)[face.vertices[k]]; }
+
+public:
+    // the object's material and texture are those of the first material added
+    explicit TriangleMesh(const std::shared_ptr< const std::vector<Point> >& vertices):
+        Object(MESH, nullptr, nullptr), _vertices(vertices) {
+        setBounds(Point(), Point());
+    }
+
+    virtual ~TriangleMesh() { }
+
+    // p0, p1, p2, p3 in order are a quad whose two triangles are in the same plane,
+    // they are taken as one face
+    static bool isFlatQuad(const Point& p0, const Point& p1, const Point& p2, const Point& p3) {
+        Vector n0 = crossProduct(p1 - p0, p2 - p0), n1 = crossProduct(p2 - p0, p3 - p0);
+        return n0.norm() > 0 && n1.norm() > 0 && (n0.normalize() - n1.normalize()).norm() < EPSILON;
+    }
+
+    // index of material and texture in the table, they are added if new
+    uint32_t addMaterial(const Material* mat, const Texture* tex) {
+        for (size_t i = _materials.size(); i-- > 0; )
+            if (_materials[i] == mat && _textures[i] == tex) return i;
+        if (_materials.empty()) setMaterial(mat), setTexture(tex);
+        _materials.push_back(mat);
+        _textures.push_back(tex);
+        return _materials.size() - 1;
+    }
+
+    // a triangle or a flat quad, of vertices in the shared array
+    void addFace(const Face& face) {
+        COUNTTYPE count = face.vertices[3] == NOVERTEX? 3: 4;
+        for (COUNTTYPE k = 0; k < count; ++k) assert(face.vertices[k] < _vertices -> size());
+        assert(face.material < _materials.size());
+        _faces.push_back(face);
+
+        Point lower, upper;
+        faceBounds(_faces.size() - 1, lower, upper);
+        if (_faces.size() > 1) {
+            for (COUNTTYPE k = 0; k < 3; ++k) {
+                lower[k] = std::min(lower[k], _lowerBound[k]);
+                upper[k] = std::max(upper[k], _upperBound[k]);
+            }
+        }
+        setBounds(lower, upper);
+    }
+
+    const std::shared_ptr< const std::vector<Point> >& vertices() const { return _vertices; }
+    COUNTTYPE faceCount() const { return _faces.size(); }
+    const Face& face(const COUNTTYPE f) const { return _faces[f]; }
+    bool isQuad(const COUNTTYPE f) const { return _faces[f].vertices[3] != NOVERTEX; }
+
+    COUNTTYPE tableSize() const { return _materials.size(); }
+    const Material* tableMaterial(const COUNTTYPE i) const { return _materials[i]; }
+    const Texture* tableTexture(const COUNTTYPE i) const { return _textures[i]; }
+    const Material* faceMaterial(const COUNTTYPE f) const { return _materials[_faces[f].material]; }
+    const Texture* faceTexture(const COUNTTYPE f) const { return _textures[_faces[f].material]; }
+
+    // vertices of triangle half of face f, enlarged as those of Triangle.
+    // the two triangles of a quad are split as those of Rectangle
+    void triangle(const COUNTTYPE f, const COUNTTYPE half, Point v[3]) const {
+        const Face& face = _faces[f];
+        const Point p[3] = { vertex(face, 0), vertex(face, half + 1), vertex(face, half + 2) };
+        Triangle::enlarge(p, v);
+    }
+
+    // bounding box of face f, as that of Triangle or Rectangle
+    void faceBounds(const COUNTTYPE f, Point& lower, Point& upper) const {
+        Point v[4];
+        COUNTTYPE count = 3;
+        if (isQuad(f)) {
+            for (COUNTTYPE k = 0; k < 4; ++k) v[k] = vertex(_faces[f], k);
+            count = 4;
+        } else {
+            triangle(f, 0, v);
+        }
+        for (COUNTTYPE k = 0; k < 3; ++k) {
+            lower[k] = upper[k] = v[0][k];
+            for (COUNTTYPE i = 1; i < count; ++i) {
+                lower[k] = std::min(lower[k], v[i][k]);
+                upper[k] = std::max(upper[k], v[i][k]);
+            }
+            // the box of a flat quad should have some thickness
+            if (count == 4 && lower[k] == upper[k]) {
+                lower[k] -= EPSILON;
+                upper[k] += EPSILON;
+            }
+        }
+    }
+
+    // hit.primitive is twice the face plus the triangle of it
+    Color texture(const Hit& hit) const {
+        const COUNTTYPE f = hit.primitive / 2;
+        const Texture* tex = faceTexture(f);
+        if (!tex) return faceMaterial(f) -> color();
+        if (!isQuad(f)) return tex -> getPixel(hit.u, hit.v, hit.u, hit.v, hit.footprint);
+        const Face& face = _faces[f];
+        return tex -> getPixel(hit.u, hit.v, (vertex(face, 1) - vertex(face, 0)).norm(),
+                               (vertex(face, 3) - vertex(face, 0)).norm(), hit.footprint);
+    }
+
+    // normal and texture axes as in Triangle, or in Rectangle for a quad
+    void fillHit(const Ray& ray, Hit& hit) const {
+        const COUNTTYPE f = hit.primitive / 2;
+        hit.point = ray.origin() + hit.distance * ray.direction();
+        Point origin;
+        Vector xAxis, yAxis;
+        if (isQuad(f)) {
+            const Face& face = _faces[f];
+            origin = vertex(face, 0);
+            hit.normal = crossProduct(vertex(face, 1) - origin, vertex(face, 2) - origin).normalize();
+            xAxis = (vertex(face, 1) - origin).normalize();
+            yAxis = (vertex(face, 3) - origin).normalize();
+        } else {
+            Point v[3];
+            triangle(f, 0, v);
+            origin = v[0];
+            hit.normal = crossProduct(v[1] - v[0], v[2] - v[0]).normalize();
+            xAxis = (v[0] - v[1]).normalize();
+            yAxis = crossProduct(hit.normal, xAxis);
+        }
+        hit.u = (hit.point - origin) * xAxis;
+        hit.v = (hit.point - origin) * yAxis;
+    }
+
+    // triangle part % 2 of face part / 2
+    INTERSECTED_TYPE isIntersected(const Ray& ray, ELEMTYPE& distance, const COUNTTYPE part) const {
+        if (part % 2 && !isQuad(part / 2)) return MISS;
+        Point v[3];
+        triangle(part / 2, part % 2, v);
+        return Triangle::intersect(v[0], v[0] - v[1], v[2] - v[0], ray, distance);
+    }
+
+    // the closest of all faces
+    INTERSECTED_TYPE isIntersected(const Ray& ray, ELEMTYPE& distance) const {
+        INTERSECTED_TYPE result = MISS;
+        for (COUNTTYPE part = 0; part < 2 * faceCount(); ++part) {
+            ELEMTYPE t;
+            if (isIntersected(ray, t, part) && (!result || t < distance)) {
+                distance = t;
+                result = INTERSECTED;
+            }
+        }
+        return result;
+    }
+};
+
+#endif /* TRIANGLEMESH_H */
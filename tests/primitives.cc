@@ -0,0 +1,255 @@
+/******************************************************************************
+ *  Copyright (c) 2014. All rights reserved.
+ *
+ *  Project: Ray Tracing
+ *  Filename: primitives.cc
+ *  Version: 1.0
+ *  Author: Jinming Hu
+ *  E-mail: hjm211324@gmail.com
+ *  Date: Oct. 17, 2026
+ *  Time: 23:59:41
+ *  Description: checks intersect and occluded of PrimitiveStreams against
+ *               the objects tested one by one, with rays that hit, miss or
+ *               graze them, and rays through the padding lanes of blocks.
+ *               built once for each lane width by run.sh
+ *****************************************************************************/
+#include <iostream>
+#include <vector>
+#include <random>
+#include <limits>
+#include <memory>
+#include "common.h"
+#include "primitives.h"
+
+using namespace std;
+using RayTracing::Point;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond) \
+    do { if (!(cond)) { ++failures; cerr << __FILE__ << ":" << __LINE__ << ": " << #cond << endl; } } while (0)
+
+// the two formulas round differently
+ELEMTYPE tolerance(const ELEMTYPE distance) {
+    return std::sqrt(numeric_limits<ELEMTYPE>::epsilon()) * std::max(ELEMTYPE(1), std::abs(distance));
+}
+
+struct Objects {
+    vector<Material> materials;
+    vector<unique_ptr<Object>> objects;
+    vector<Primitive> primitives;
+    vector<const Primitive*> pointers;
+
+    Objects() {
+        // ambient coefficients tell the materials apart, the last one is transparent
+        for (COUNTTYPE i = 0; i < 4; ++i)
+            materials.push_back(Material(blackColor, 0.1 * i, 0, 0, 0, 1, 0, 0, i == 3));
+        // kept off the origin, where padding lanes are
+        add(new Triangle(Point(1, 1, 5), Point(4, 1, 5), Point(1, 4, 5), &materials[0], nullptr));
+        add(new Sphere(Point(-3, 2, 8), 1.5, &materials[1], nullptr));
+        add(new Rectangle(Point(-4, -4, 10), Point(4, -4, 10), Point(4, 4, 10), Point(-4, 4, 10),
+                          &materials[2], nullptr));
+        add(new Triangle(Point(-2, -3, 6), Point(0, -1, 7), Point(-3, 0, 6.5), &materials[3], nullptr));
+        add(new Sphere(Point(2, -2, 7), 1, &materials[3], nullptr));
+        add(new Rectangle(Point(5, -2, 3), Point(5, 2, 3), Point(5, 2, 9), Point(5, -2, 9),
+                          &materials[1], nullptr));
+        add(new Sphere(Point(0, 3, 12), 2, &materials[0], nullptr));
+        add(new Triangle(Point(-5, -5, 4), Point(-3, -5, 4), Point(-5, -3, 4), &materials[2], nullptr));
+        add(new Sphere(Point(-1, -1, 3), 0.5, &materials[2], nullptr));
+        for (auto& p: primitives) pointers.push_back(&p);
+    }
+
+    void add(Object* obj) {
+        objects.emplace_back(obj);
+        primitives.push_back(Primitive(obj, 0));
+    }
+};
+
+// closest of the first count objects, the closest opaque one,
+// and how far the next object is beyond the closest
+struct Expected {
+    const Object* object = nullptr;
+    ELEMTYPE distance = ELEMTYPE_MAX;
+    ELEMTYPE opaque = ELEMTYPE_MAX;
+    ELEMTYPE next = ELEMTYPE_MAX;
+};
+
+Expected expected(const Objects& objs, const COUNTTYPE count, const Ray& ray) {
+    Expected e;
+    for (COUNTTYPE i = 0; i < count; ++i) {
+        const Object* o = objs.objects[i].get();
+        ELEMTYPE d;
+        if (!o -> isIntersected(ray, d)) continue;
+        if (!o -> material() -> isTransparent()) e.opaque = std::min(e.opaque, d);
+        if (d < e.distance) {
+            e.next = e.distance;
+            e.distance = d;
+            e.object = o;
+        }
+        else e.next = std::min(e.next, d);
+    }
+    return e;
+}
+
+void check(const PrimitiveStreams& streams, const PrimitiveStreams::Range& range,
+           const Objects& objs, const COUNTTYPE count, const Ray& ray) {
+    Expected e = expected(objs, count, ray);
+
+    // each query with a new ray id, so the mailbox skips nothing
+    Hit hit;
+    PrimitiveStreams::RayLanes lanes(ray, streams);
+    bool found = streams.intersect(range, lanes, hit);
+    CHECK(found == (e.object != nullptr));
+    if (found && e.object) {
+        CHECK(hit.object != nullptr);
+        CHECK(std::abs(hit.distance - e.distance) <= tolerance(e.distance));
+        if (e.next - e.distance > 2 * tolerance(e.distance)) {
+            CHECK(hit.object == e.object);
+            CHECK(streams.material(hit.material).ambientCoefficient() ==
+                  hit.object -> material() -> ambientCoefficient());
+        }
+        // the triangle of a rectangle hit
+        if (hit.object -> type() == Object::RECTANGLE) {
+            ELEMTYPE d;
+            CHECK(hit.primitive == 0 || hit.primitive == 1);
+            CHECK(static_cast<const Rectangle*>(hit.object) -> triangle(hit.primitive).isIntersected(ray, d));
+        }
+        else CHECK(hit.primitive == 0);
+    }
+    else CHECK(hit.distance == ELEMTYPE_MAX);
+
+    // nothing closer than hit.distance already is
+    if (e.object && e.distance > 1) {
+        Hit closer;
+        closer.distance = e.distance * 0.5;
+        PrimitiveStreams::RayLanes l(ray, streams);
+        CHECK(!streams.intersect(range, l, closer));
+        CHECK(closer.distance == e.distance * 0.5 && closer.object == nullptr);
+    }
+
+    // transparent objects never occlude
+    vector<ELEMTYPE> limits = { ELEMTYPE_MAX };
+    if (e.opaque < ELEMTYPE_MAX) {
+        limits.push_back(e.opaque * 0.99);
+        limits.push_back(e.opaque * 1.01);
+    }
+    for (ELEMTYPE tMax: limits) {
+        PrimitiveStreams::RayLanes l(ray, streams);
+        CHECK(streams.occluded(range, l, tMax) == (e.opaque < tMax));
+    }
+}
+
+Point pointIn(const Object* o, mt19937& random) {
+    uniform_real_distribution<ELEMTYPE> unit(0.1, 0.4);
+    switch (o -> type()) {
+        case Object::SPHERE: {
+            const Sphere* s = static_cast<const Sphere*>(o);
+            return s -> center() + s -> radius() * Vector(unit(random), -unit(random), unit(random));
+        }
+        case Object::TRIANGLE: {
+            const Triangle* t = static_cast<const Triangle*>(o);
+            ELEMTYPE b = unit(random), c = unit(random);
+            return t -> vertices(0) + b * (t -> vertices(1) - t -> vertices(0)) +
+                                      c * (t -> vertices(2) - t -> vertices(0));
+        }
+        default: {
+            const Rectangle* r = static_cast<const Rectangle*>(o);
+            return pointIn(&r -> triangle(random() % 2), random);
+        }
+    }
+}
+
+vector<Ray> rays(const Objects& objs) {
+    vector<Ray> result;
+    mt19937 random(1);
+    uniform_real_distribution<ELEMTYPE> around(-6, 6);
+
+    // hits, aimed at points well inside each object
+    for (auto& o: objs.objects) {
+        for (COUNTTYPE i = 0; i < 16; ++i) {
+            Point origin(around(random), around(random), -10);
+            result.push_back(Ray(origin, pointIn(o.get(), random) - origin));
+        }
+    }
+    // misses, pointing away from all of them
+    for (COUNTTYPE i = 0; i < 16; ++i) {
+        Point origin(around(random), around(random), 0);
+        result.push_back(Ray(origin, Vector(around(random), around(random), -1)));
+    }
+    // grazing: along the plane of the first triangle and of the large rectangle,
+    // tangent to the first sphere, just outside it, and through a corner
+    // and the diagonal of the large rectangle
+    result.push_back(Ray(Point(0, 2, 5), Vector(1, 0, 0)));
+    result.push_back(Ray(Point(-10, 0, 10), Vector(1, 0.5, 0)));
+    result.push_back(Ray(Point(-10, 3.5, 8), Vector(1, 0, 0)));
+    result.push_back(Ray(Point(-10, 3.5001, 8), Vector(1, 0, 0)));
+    result.push_back(Ray(Point(-10, -10, 0), Point(4, 4, 10) - Point(-10, -10, 0)));
+    result.push_back(Ray(Point(-10, 10, 0), Vector(0.75, -0.75, 1)));
+    result.push_back(Ray(Point(0, 0, 0), Vector(0.001, 0, 1)));
+    // from inside a sphere
+    result.push_back(Ray(Point(-3, 2.5, 8), Vector(0, 1, 1)));
+    // padding lanes are triangles and spheres at the origin, these go through
+    // or start at it and should only hit what they pass by
+    for (COUNTTYPE i = 0; i < 16; ++i) {
+        Vector d(around(random), around(random), around(random));
+        result.push_back(Ray(Point(0, 0, 0), d));
+        result.push_back(Ray(Point(0, 0, 0) - ELEMTYPE(10) * d, d));
+    }
+    result.push_back(Ray(Point(0, 0, 0), Vector(0, 0, -1)));
+    result.push_back(Ray(Point(-1, 0, 0), Vector(1, 0, 0)));
+    return result;
+}
+
+// a block is tested once by a ray in all leaves,
+// but again by another ray of the packet
+void checkMailbox(const Objects& objs) {
+    PrimitiveStreams streams;
+    COUNTTYPE count = objs.pointers.size();
+    PrimitiveStreams::Range a = streams.insert(objs.pointers.data(), count);
+    PrimitiveStreams::Range b = streams.insert(objs.pointers.data(), count);
+    // rectangles are two triangles
+    unsigned long long primitives = count + 2;
+
+    mt19937 random(2);
+    Ray ray(Point(0, 0, -10), pointIn(objs.objects[2].get(), random) - Point(0, 0, -10));
+    Hit hit;
+    PrimitiveStreams::RayLanes first(ray, streams), second;
+    second.set(ray, first, 1);
+    CHECK(streams.intersect(a, first, hit));
+    Hit again;
+    CHECK(!streams.intersect(b, first, again));
+    streams.countTests(first);
+    CHECK(streams.objectTests() == primitives);
+    CHECK(streams.duplicateTestsAvoided() == primitives);
+
+    Hit other;
+    CHECK(streams.intersect(b, second, other));
+    CHECK(other.object == hit.object && other.distance == hit.distance);
+    CHECK(!streams.occluded(a, second, ELEMTYPE_MAX));
+    streams.countTests(second);
+    CHECK(streams.objectTests() == 2 * primitives);
+    CHECK(streams.duplicateTestsAvoided() == 2 * primitives);
+}
+
+}
+
+int main() {
+    Objects objs;
+    vector<Ray> all = rays(objs);
+
+    // every count of objects, so the last blocks have each number of padding lanes
+    PrimitiveStreams streams;
+    vector<PrimitiveStreams::Range> ranges;
+    for (COUNTTYPE count = 1; count <= COUNTTYPE(objs.pointers.size()); ++count)
+        ranges.push_back(streams.insert(objs.pointers.data(), count));
+    for (COUNTTYPE count = 1; count <= COUNTTYPE(ranges.size()); ++count)
+        for (auto& ray: all) check(streams, ranges[count - 1], objs, count, ray);
+
+    checkMailbox(objs);
+
+    cout << "lanes " << COUNTTYPE(Lanes<ELEMTYPE>::WIDTH) << ", " << sizeof(ELEMTYPE) * 8 << " bits: "
+         << all.size() << " rays, " << failures << " failures" << endl;
+    return failures != 0;
+}
@@ -0,0 +1,15 @@
+#!/bin/sh
+# builds and runs the tests for each lane width, in double and single precision:
+# AVX, SSE2, and one lane with the SIMD macros undefined
+# usage: tests/run.sh [compiler flags ...]
+cd "$(dirname "$0")" || exit 1
+out=$(mktemp -d) || exit 1
+trap 'rm -rf "$out"' EXIT
+status=0
+for lanes in "-mavx" "-msse2" "-U__AVX__ -U__SSE2__"; do
+    for precision in "" "-DSINGLE_PRECISION"; do
+        ${CXX:-g++} -std=c++11 -O2 -Wall -Wno-reorder -I../src $lanes $precision "$@" primitives.cc -o "$out/primitives" &&
+            "$out/primitives" || status=1
+    done
+done
+exit $status